@@ -0,0 +1,98 @@
+#pragma once
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+/******************************************************************************/
+// Shelf packing of rectangles in an atlas page, top-left origin. Regions are placed
+// left to right on shelves, a new shelf is opened below the last one when no shelf
+// of a close height has room. Freed spans are reused in place, trailing empty
+// shelves are removed. Regions never move: growing the page means packing again.
+class AtlasPacker
+{
+public:
+    void reset(const QSize& pSize)
+    {
+        m_size = pSize;
+        m_shelves.clear();
+    }
+
+    QSize size() const { return m_size; }
+    bool isEmpty() const { return m_shelves.empty(); }
+
+    // False if pSize doesn't fit in the free space
+    bool alloc(const QSize& pSize, QRect& pRect)
+    {
+        if (pSize.width() > m_size.width() || pSize.height() > m_size.height())
+            return false;
+
+        // A shelf of a close height first, then any shelf tall enough, then a new one
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (Shelf& shelf : m_shelves)
+            {
+                if (shelf.height < pSize.height() || (pass == 0 && shelf.height > pSize.height() + pSize.height() / 2))
+                    continue;
+                const int xx = shelf.findGap(pSize.width(), m_size.width());
+                if (xx >= 0)
+                {
+                    shelf.insert(xx, pSize.width());
+                    pRect = QRect(QPoint(xx, shelf.y), pSize);
+                    return true;
+                }
+            }
+        }
+
+        const int yy = m_shelves.empty() ? 0 : m_shelves.back().y + m_shelves.back().height;
+        if (yy + pSize.height() > m_size.height())
+            return false;
+        m_shelves.push_back(Shelf{ yy, pSize.height(), {} });
+        m_shelves.back().insert(0, pSize.width());
+        pRect = QRect(QPoint(0, yy), pSize);
+        return true;
+    }
+
+    void free(const QRect& pRect)
+    {
+        auto shelf = std::find_if(m_shelves.begin(), m_shelves.end(), [&pRect](const Shelf& pShelf) { return pShelf.y == pRect.top(); });
+        if (shelf == m_shelves.end())
+            return;
+        shelf->used.erase(std::remove_if(shelf->used.begin(), shelf->used.end(),
+            [&pRect](const std::pair<int, int>& pSpan) { return pSpan.first == pRect.left(); }), shelf->used.end());
+        while (!m_shelves.empty() && m_shelves.back().used.empty())
+            m_shelves.pop_back();
+    }
+
+private:
+    struct Shelf
+    {
+        int y;
+        int height;
+        std::vector<std::pair<int, int>> used; // [begin, end) spans, sorted
+
+        // Leftmost free span of pWidth, -1 if none
+        int findGap(int pWidth, int pPageWidth) const
+        {
+            int xx = 0;
+            for (const std::pair<int, int>& span : used)
+            {
+                if (span.first - xx >= pWidth)
+                    return xx;
+                xx = span.second;
+            }
+            return pPageWidth - xx >= pWidth ? xx : -1;
+        }
+
+        void insert(int pX, int pWidth)
+        {
+            const std::pair<int, int> span(pX, pX + pWidth);
+            used.insert(std::upper_bound(used.begin(), used.end(), span), span);
+        }
+    };
+
+    QSize m_size;
+    std::vector<Shelf> m_shelves;
+};
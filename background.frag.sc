@@ -0,0 +1,15 @@
+$input v_texcoord0
+
+#include <bgfx_shader.sh>
+
+SAMPLER2D(s_texColor, 0);
+uniform vec4 u_texLod; // x: finest resident mip, yz: texture size
+
+void main()
+{
+	// Regular mip selection, clamped to the levels streamed in so far
+	vec2 texel = v_texcoord0 * u_texLod.yz;
+	float rho = max(dot(dFdx(texel), dFdx(texel) ), dot(dFdy(texel), dFdy(texel) ) );
+	float lod = max(0.5*log2(rho), u_texLod.x);
+	gl_FragColor = texture2DLod(s_texColor, v_texcoord0, lod);
+}
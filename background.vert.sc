@@ -0,0 +1,11 @@
+$input a_position, a_texcoord0
+$output v_texcoord0
+
+#include <bgfx_shader.sh>
+
+void main()
+{
+	// Clip space quad on the far plane
+	gl_Position = vec4(a_position, 1.0);
+	v_texcoord0 = a_texcoord0;
+}
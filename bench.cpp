@@ -0,0 +1,377 @@
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QtQml/QQmlContext>
+#include <QtQuick/QQuickView>
+#include "bgfxItem.h"
+#include "transforms.h"
+#include <bx/math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/******************************************************************************/
+// Count every C++ heap allocation of the process
+static std::atomic<uint64_t> s_allocations(0);
+
+void* operator new(std::size_t pSize)
+{
+    ++s_allocations;
+    if (void* ptr = std::malloc(pSize ? pSize : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pPtr) noexcept
+{
+    std::free(pPtr);
+}
+
+/******************************************************************************/
+static double processCpuTimeMs()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    auto toMs = [](const FILETIME& pTime) { return double((uint64_t(pTime.dwHighDateTime) << 32) | pTime.dwLowDateTime) / 10000.0; };
+    return toMs(kernel) + toMs(user);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return double(ts.tv_sec) * 1000.0 + double(ts.tv_nsec) / 1000000.0;
+#endif
+}
+
+/******************************************************************************/
+struct BenchConfig
+{
+    QSGRendererInterface::GraphicsApi backend;
+    InteropMode::Enum interopMode;
+    ThreadingMode::Enum threadingMode;
+    int windows;
+    int items;
+    int grid;
+    bool instanced;
+    bool occlusionCulling;
+};
+
+struct BenchResult
+{
+    int frames = 0;
+    double fps = 0.0;
+    double cpuMsPerFrame = 0.0;
+    double allocsPerFrame = 0.0;        // C++ heap allocations
+    double bgfxAllocsPerFrame = 0.0;    // bgfx allocator
+};
+
+/******************************************************************************/
+// Render pWarmup + pFrames frames of the first window, measure the last pFrames
+static BenchResult runBench(const BenchConfig& pConfig, int pWarmup, int pFrames, int pTimeoutMs)
+{
+    InitQt_BGFX_Backend(pConfig.backend, pConfig.interopMode, pConfig.threadingMode, pConfig.instanced ? pConfig.grid : 0);
+
+    std::vector<std::unique_ptr<QQuickView>> views;
+    for (int ii = 0; ii < pConfig.windows; ++ii)
+    {
+        QQuickView* view = new QQuickView;
+        views.emplace_back(view);
+        view->rootContext()->setContextProperty("benchItemCount", pConfig.items);
+        view->rootContext()->setContextProperty("benchGridSize", pConfig.grid);
+        view->rootContext()->setContextProperty("benchInstanced", pConfig.instanced);
+        view->rootContext()->setContextProperty("benchOcclusionCulling", pConfig.occlusionCulling);
+        view->setResizeMode(QQuickView::SizeRootObjectToView);
+        view->setSource(QUrl("qrc:///bench.qml"));
+        view->resize(640, 480);
+        view->show();
+    }
+
+    int frameCount = 0;
+    QObject::connect(views.front().get(), &QQuickWindow::frameSwapped, [&frameCount] { ++frameCount; });
+
+    QElapsedTimer timeout;
+    timeout.start();
+    auto runUntil = [&](int pFrameCount)
+    {
+        while (frameCount < pFrameCount && !timeout.hasExpired(pTimeoutMs))
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    };
+
+    runUntil(pWarmup);
+
+    const int firstFrame = frameCount;
+    const uint64_t allocations = s_allocations;
+    const uint64_t bgfxAllocations = BgfxAllocationCount();
+    const double cpuTime = processCpuTimeMs();
+    QElapsedTimer wallTime;
+    wallTime.start();
+
+    runUntil(pWarmup + pFrames);
+
+    BenchResult result;
+    result.frames = frameCount - firstFrame;
+    if (result.frames > 0)
+    {
+        result.fps = result.frames * 1000.0 / std::max<qint64>(wallTime.elapsed(), 1);
+        result.cpuMsPerFrame = (processCpuTimeMs() - cpuTime) / result.frames;
+        result.allocsPerFrame = double(s_allocations - allocations) / result.frames;
+        result.bgfxAllocsPerFrame = double(BgfxAllocationCount() - bgfxAllocations) / result.frames;
+    }
+
+    // Windows release their renderers before bgfx shuts down
+    views.clear();
+    QCoreApplication::processEvents();
+    FinalizeQt_BGFX_Backend();
+
+    return result;
+}
+
+/******************************************************************************/
+struct TransformBenchResult
+{
+    double scalarMs = 0.0;  // per pass, bx::mtxRotateXY() per instance
+    double soaMs = 0.0;     // per pass, AnimatedTransforms::compute()
+    double maxError = 0.0;
+};
+
+// Model matrices of pCount animated instances, the scalar loop ExampleCubes used before
+// AnimatedTransforms against it, single threaded, best of pPasses
+static TransformBenchResult runTransformBench(uint32_t pCount, int pPasses)
+{
+    const uint32_t grid = std::max<uint32_t>(1, uint32_t(std::ceil(std::sqrt(double(pCount)))));
+    AnimatedTransforms transforms;
+    transforms.resize(pCount);
+    for (uint32_t ii = 0; ii < pCount; ++ii)
+    {
+        transforms.x[ii] = float(ii % grid) * 3.0f;
+        transforms.y[ii] = float(ii / grid) * 3.0f;
+        transforms.z[ii] = 0.0f;
+        transforms.phaseX[ii] = (ii % grid) * 0.21f;
+        transforms.phaseY[ii] = (ii / grid) * 0.37f;
+    }
+
+    std::vector<float> scalar(size_t(pCount) * 16);
+    std::vector<float> soa(size_t(pCount) * 16);
+    TransformBenchResult result;
+    result.scalarMs = result.soaMs = 1e9;
+    QElapsedTimer timer;
+    for (int pass = 0; pass < pPasses; ++pass)
+    {
+        const float time = 1.0f + pass * 0.016f;
+
+        timer.start();
+        for (uint32_t ii = 0; ii < pCount; ++ii)
+        {
+            float* mtx = scalar.data() + size_t(ii) * 16;
+            bx::mtxRotateXY(mtx, time + transforms.phaseX[ii], time + transforms.phaseY[ii]);
+            mtx[12] = transforms.x[ii];
+            mtx[13] = transforms.y[ii];
+            mtx[14] = transforms.z[ii];
+        }
+        result.scalarMs = std::min(result.scalarMs, timer.nsecsElapsed() / 1000000.0);
+
+        timer.start();
+        transforms.compute(nullptr, pCount, time, reinterpret_cast<uint8_t*>(soa.data()), 64);
+        result.soaMs = std::min(result.soaMs, timer.nsecsElapsed() / 1000000.0);
+    }
+
+    for (size_t ii = 0; ii < scalar.size(); ++ii)
+        result.maxError = std::max(result.maxError, double(std::abs(scalar[ii] - soa[ii])));
+    return result;
+}
+
+/******************************************************************************/
+static QList<int> parseIntList(const QString& pValue)
+{
+    QList<int> values;
+    for (const QString& item : pValue.split(',', QString::SkipEmptyParts))
+        values << item.trimmed().toInt();
+    return values;
+}
+
+static bool parseInteropMode(const QString& pName, InteropMode::Enum& pMode)
+{
+    const QString name = pName.trimmed().toLower();
+    if (name == "externplatform") pMode = InteropMode::ExternPlatform;
+    else if (name == "synchroframebuffer") pMode = InteropMode::SynchroFramebuffer;
+    else if (name == "offscreenframebuffer") pMode = InteropMode::OffscreenFramebuffer;
+    else if (name == "texturenode") pMode = InteropMode::TextureNode;
+    else if (name == "textureatlas") pMode = InteropMode::TextureAtlas;
+    else return false;
+    return true;
+}
+
+static const char* interopModeName(InteropMode::Enum pMode)
+{
+    switch (pMode)
+    {
+    case InteropMode::ExternPlatform: return "ExternPlatform";
+    case InteropMode::SynchroFramebuffer: return "SynchroFramebuffer";
+    case InteropMode::OffscreenFramebuffer: return "OffscreenFramebuffer";
+    case InteropMode::TextureNode: return "TextureNode";
+    case InteropMode::TextureAtlas: return "TextureAtlas";
+    default: return "?";
+    }
+}
+
+/******************************************************************************/
+// Headless benchmark of the CPU side submission cost.
+// Default runs Qt offscreen platform with the software scene graph and the bgfx
+// Noop renderer, so it doesn't need a GPU. --backend gl can be used with Mesa
+// llvmpipe (set QT_QPA_PLATFORM to a platform providing GL).
+int main(int argc, char **argv)
+{
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    qputenv("QSG_RENDER_LOOP", "basic");
+
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setVersion(3, 3);
+    QSurfaceFormat::setDefaultFormat(format);
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+
+    QGuiApplication app(argc, argv);
+    qmlRegisterType<BgfxItem>("BgfxItemQML", 1, 0, "BgfxItem");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("qt-rhi-bgfx headless benchmark");
+    parser.addHelpOption();
+    QCommandLineOption backendOption("backend", "noop, gl or d3d11.", "backend", "noop");
+    QCommandLineOption threadingOption("threading", "single, multi or worker (threaded render loop).", "threading", "single");
+    QCommandLineOption windowsOption("windows", "Window counts, comma separated.", "list", "1,2");
+    QCommandLineOption itemsOption("items", "Items per window, comma separated.", "list", "1,4,16");
+    QCommandLineOption gridOption("grid", "Cube grid sizes, comma separated.", "list", "11,100");
+    QCommandLineOption interopOption("interop", "Interop modes, comma separated (only OffscreenFramebuffer with noop).", "list", "OffscreenFramebuffer");
+    QCommandLineOption instancedOption("instanced", "Draw the cubes with instancing.");
+    QCommandLineOption occlusionOption("occlusion", "Also cull the instanced cubes on the GPU (hierarchical Z), needs compute support.");
+    QCommandLineOption framesOption("frames", "Measured frames per configuration.", "count", "300");
+    QCommandLineOption warmupOption("warmup", "Warmup frames per configuration.", "count", "30");
+    QCommandLineOption timeoutOption("timeout", "Timeout per configuration in ms.", "ms", "60000");
+    QCommandLineOption csvOption("csv", "Also write the results to a CSV file.", "file");
+    QCommandLineOption transformsOption("transforms", "Only benchmark the model matrix generation, instance counts comma separated (e.g. 10000,100000,1000000).", "list");
+    parser.addOptions({ backendOption, threadingOption, windowsOption, itemsOption, gridOption, interopOption,
+        instancedOption, occlusionOption, framesOption, warmupOption, timeoutOption, csvOption, transformsOption });
+    parser.process(app);
+
+    if (parser.isSet(transformsOption))
+    {
+        QTextStream out(stdout);
+        out << QString("%1 %2 %3 %4 %5\n").arg("instances", 10).arg("scalar ms", 10).arg("soa ms", 10).arg("speedup", 8).arg("max err", 10);
+        for (int count : parseIntList(parser.value(transformsOption)))
+        {
+            const TransformBenchResult result = runTransformBench(uint32_t(std::max(count, 1)), 20);
+            out << QString("%1 %2 %3 %4 %5\n").arg(count, 10)
+                .arg(result.scalarMs, 10, 'f', 3).arg(result.soaMs, 10, 'f', 3)
+                .arg(result.scalarMs / std::max(result.soaMs, 1e-6), 8, 'f', 2).arg(result.maxError, 10, 'g', 2);
+            out.flush();
+        }
+        return 0;
+    }
+
+    BenchConfig config = {};
+    const QString backend = parser.value(backendOption).toLower();
+    if (backend == "noop") config.backend = QSGRendererInterface::Software;
+    else if (backend == "gl") config.backend = QSGRendererInterface::OpenGLRhi;
+    else if (backend == "d3d11") config.backend = QSGRendererInterface::Direct3D11Rhi;
+    else
+    {
+        qCritical("Unknown backend %s", qPrintable(backend));
+        return 1;
+    }
+    const QString threading = parser.value(threadingOption).toLower();
+    config.threadingMode = threading == "multi" ? ThreadingMode::MultiThread
+        : threading == "worker" ? ThreadingMode::WorkerThread : ThreadingMode::SingleThread;
+    // Read when the first window is created
+    if (config.threadingMode == ThreadingMode::WorkerThread)
+        qputenv("QSG_RENDER_LOOP", "threaded");
+    config.instanced = parser.isSet(instancedOption);
+    config.occlusionCulling = parser.isSet(occlusionOption);
+
+    QList<InteropMode::Enum> interopModes;
+    for (const QString& name : parser.value(interopOption).split(',', QString::SkipEmptyParts))
+    {
+        InteropMode::Enum mode;
+        if (!parseInteropMode(name, mode))
+        {
+            qCritical("Unknown interop mode %s", qPrintable(name));
+            return 1;
+        }
+        // The Noop renderer has no texture to share with Qt, its rows would all measure OffscreenFramebuffer
+        if (config.backend == QSGRendererInterface::Software && mode != InteropMode::OffscreenFramebuffer)
+        {
+            qWarning("Skipping interop mode %s: the noop backend only supports OffscreenFramebuffer", qPrintable(name));
+            continue;
+        }
+        interopModes << mode;
+    }
+    if (interopModes.isEmpty())
+    {
+        qCritical("No interop mode to benchmark with the %s backend", qPrintable(backend));
+        return 1;
+    }
+
+    const int frames = parser.value(framesOption).toInt();
+    const int warmup = parser.value(warmupOption).toInt();
+    const int timeout = parser.value(timeoutOption).toInt();
+
+    QString csv = "backend,interop,windows,items,grid,instanced,occlusion,frames,fps,cpuMsPerFrame,allocsPerFrame,bgfxAllocsPerFrame\n";
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+        .arg("interop", -20).arg("windows", 8).arg("items", 6).arg("grid", 6)
+        .arg("fps", 10).arg("cpu ms/f", 10).arg("allocs/f", 10).arg("bgfx al/f", 10);
+
+    for (InteropMode::Enum interopMode : interopModes)
+    {
+        for (int windows : parseIntList(parser.value(windowsOption)))
+        {
+            for (int items : parseIntList(parser.value(itemsOption)))
+            {
+                for (int grid : parseIntList(parser.value(gridOption)))
+                {
+                    config.interopMode = interopMode;
+                    config.windows = windows;
+                    config.items = items;
+                    config.grid = grid;
+                    const BenchResult result = runBench(config, warmup, frames, timeout);
+
+                    out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+                        .arg(interopModeName(interopMode), -20).arg(windows, 8).arg(items, 6).arg(grid, 6)
+                        .arg(result.fps, 10, 'f', 1).arg(result.cpuMsPerFrame, 10, 'f', 3)
+                        .arg(result.allocsPerFrame, 10, 'f', 1).arg(result.bgfxAllocsPerFrame, 10, 'f', 1);
+                    out.flush();
+
+                    csv += QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,%12\n")
+                        .arg(backend).arg(interopModeName(interopMode)).arg(windows).arg(items).arg(grid)
+                        .arg(config.instanced ? 1 : 0).arg(config.occlusionCulling ? 1 : 0).arg(result.frames).arg(result.fps)
+                        .arg(result.cpuMsPerFrame).arg(result.allocsPerFrame).arg(result.bgfxAllocsPerFrame);
+                }
+            }
+        }
+    }
+
+    if (parser.isSet(csvOption))
+    {
+        QFile file(parser.value(csvOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        {
+            qCritical("Can't write %s", qPrintable(file.fileName()));
+            return 1;
+        }
+        file.write(csv.toUtf8());
+    }
+
+    return 0;
+}
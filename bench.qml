@@ -0,0 +1,28 @@
+import QtQuick 2.0
+import BgfxItemQML 1.0
+
+// Scene used by qt-rhi-bgfx-bench, parameters are set as context properties
+Item {
+
+    width: 640
+    height: 480
+
+    // Items are tiled, their size only matters in TextureAtlas mode: the other
+    // modes render the whole window
+    Grid {
+        id: grid
+        anchors.fill: parent
+        columns: Math.ceil(Math.sqrt(benchItemCount))
+
+        Repeater {
+            model: benchItemCount
+            BgfxItem {
+                width: grid.width / grid.columns
+                height: grid.height / Math.ceil(benchItemCount / grid.columns)
+                gridSize: benchGridSize
+                instanced: benchInstanced
+                occlusionCulling: benchOcclusionCulling
+            }
+        }
+    }
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <bgfx/bgfx.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <map>
+
+Q_DECLARE_LOGGING_CATEGORY(lcBgfx)
+Q_DECLARE_LOGGING_CATEGORY(lcBgfxCache)
+
+/******************************************************************************/
+// bgfx callback: traces and fatals go to Qt logging ("bgfx" category), compiled
+// shader/program binaries are persisted on disk so warm launches don't compile them
+// again (bgfx uses it for GL program binaries).
+// The cache directory is per renderer type and driver, files are named after the
+// bgfx cache id (hash of the shaders). The cache is bounded to MaxCacheBytes, least
+// recently used files are evicted first. Callbacks may come from the bgfx render
+// thread and the API thread.
+class bgfxCallback : public bgfx::CallbackI
+{
+public:
+    static const qint64 MaxCacheBytes = 64 * 1024 * 1024;
+
+    // pDriver identifies the device and driver version, a driver update invalidates the cache
+    void openCache(bgfx::RendererType::Enum pBackend, const QByteArray& pDriver)
+    {
+        QMutexLocker lock(&m_mutex);
+        m_entries.clear();
+        m_cacheBytes = 0;
+        m_cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + QString("/bgfx-shaders/%1-%2").arg(bgfx::getRendererName(pBackend))
+                .arg(qHash(pDriver), 8, 16, QLatin1Char('0'));
+        QDir().mkpath(m_cacheDir);
+
+        const QFileInfoList files = QDir(m_cacheDir).entryInfoList(QStringList() << "*.bin", QDir::Files);
+        for (const QFileInfo& file : files)
+        {
+            bool ok = false;
+            const uint64_t id = file.completeBaseName().toULongLong(&ok, 16);
+            if (!ok)
+                continue;
+            m_entries[id] = { uint32_t(file.size()), file.lastModified().toMSecsSinceEpoch() };
+            m_cacheBytes += file.size();
+        }
+        qCDebug(lcBgfxCache, "%s: %d entries, %lld bytes", qPrintable(m_cacheDir), int(m_entries.size()), m_cacheBytes);
+    }
+
+    // --- Logging
+    void fatal(const char* _filePath, uint16_t _line, bgfx::Fatal::Enum _code, const char* _str) override
+    {
+        if (_code == bgfx::Fatal::DebugCheck)
+        {
+            qCCritical(lcBgfx, "%s(%d): %s", _filePath, _line, _str);
+            return;
+        }
+        // bgfx can't continue after other fatals
+        qFatal("bgfx fatal 0x%08x %s(%d): %s", uint32_t(_code), _filePath, _line, _str);
+    }
+
+    void traceVargs(const char* _filePath, uint16_t _line, const char* _format, va_list _argList) override
+    {
+        if (!lcBgfx().isDebugEnabled())
+            return;
+
+        char message[2048];
+        int length = vsnprintf(message, sizeof(message), _format, _argList);
+        length = qBound(0, length, int(sizeof(message)) - 1);
+        while (length > 0 && (message[length - 1] == '\n' || message[length - 1] == '\r'))
+            message[--length] = '\0';
+        qCDebug(lcBgfx, "%s(%d): %s", _filePath, _line, message);
+    }
+
+    void profilerBegin(const char*, uint32_t, const char*, uint16_t) override { }
+    void profilerBeginLiteral(const char*, uint32_t, const char*, uint16_t) override { }
+    void profilerEnd() override { }
+
+    // --- Shader cache
+    uint32_t cacheReadSize(uint64_t _id) override
+    {
+        QMutexLocker lock(&m_mutex);
+        auto entry = m_entries.find(_id);
+        return entry != m_entries.end() ? entry->second.size : 0;
+    }
+
+    bool cacheRead(uint64_t _id, void* _data, uint32_t _size) override
+    {
+        QMutexLocker lock(&m_mutex);
+        QFile file(cacheFile(_id));
+        if (!file.open(QIODevice::ReadOnly) || file.read(static_cast<char*>(_data), _size) != qint64(_size))
+        {
+            qCWarning(lcBgfxCache, "Can't read %s", qPrintable(file.fileName()));
+            removeEntry(_id);
+            return false;
+        }
+        file.close();
+
+        // Most recently used, the modification time keeps the order across launches
+        const QDateTime now = QDateTime::currentDateTime();
+        if (file.open(QIODevice::Append))
+            file.setFileTime(now, QFileDevice::FileModificationTime);
+        m_entries[_id].lastUsed = now.toMSecsSinceEpoch();
+        qCDebug(lcBgfxCache, "Hit %016llx (%u bytes)", qulonglong(_id), _size);
+        return true;
+    }
+
+    void cacheWrite(uint64_t _id, const void* _data, uint32_t _size) override
+    {
+        QMutexLocker lock(&m_mutex);
+        if (m_cacheDir.isEmpty() || _size > MaxCacheBytes)
+            return;
+
+        QSaveFile file(cacheFile(_id));
+        if (!file.open(QIODevice::WriteOnly)
+            || file.write(static_cast<const char*>(_data), _size) != qint64(_size)
+            || !file.commit())
+        {
+            qCWarning(lcBgfxCache, "Can't write %s", qPrintable(file.fileName()));
+            return;
+        }
+
+        removeEntry(_id, false);
+        m_entries[_id] = { _size, QDateTime::currentMSecsSinceEpoch() };
+        m_cacheBytes += _size;
+        qCDebug(lcBgfxCache, "Stored %016llx (%u bytes)", qulonglong(_id), _size);
+        evict(_id);
+    }
+
+    // --- Unused
+    void screenShot(const char*, uint32_t, uint32_t, uint32_t, const void*, uint32_t, bool) override { }
+    void captureBegin(uint32_t, uint32_t, uint32_t, bgfx::TextureFormat::Enum, bool) override { }
+    void captureEnd() override { }
+    void captureFrame(const void*, uint32_t) override { }
+
+private:
+    struct Entry
+    {
+        uint32_t size;
+        qint64 lastUsed;    // ms since epoch, file modification time on disk
+    };
+
+    QString cacheFile(uint64_t pId) const
+    {
+        return m_cacheDir + QString("/%1.bin").arg(qulonglong(pId), 16, 16, QLatin1Char('0'));
+    }
+
+    void removeEntry(uint64_t pId, bool pRemoveFile = true)
+    {
+        auto entry = m_entries.find(pId);
+        if (entry == m_entries.end())
+            return;
+        m_cacheBytes -= entry->second.size;
+        m_entries.erase(entry);
+        if (pRemoveFile)
+            QFile::remove(cacheFile(pId));
+    }
+
+    // Remove least recently used entries over MaxCacheBytes, except pKeep
+    void evict(uint64_t pKeep)
+    {
+        while (m_cacheBytes > MaxCacheBytes && m_entries.size() > 1)
+        {
+            auto oldest = m_entries.end();
+            for (auto entry = m_entries.begin(); entry != m_entries.end(); ++entry)
+            {
+                if (entry->first != pKeep && (oldest == m_entries.end() || entry->second.lastUsed < oldest->second.lastUsed))
+                    oldest = entry;
+            }
+            qCDebug(lcBgfxCache, "Evict %016llx", qulonglong(oldest->first));
+            removeEntry(oldest->first);
+        }
+    }
+
+    QMutex m_mutex;
+    QString m_cacheDir;
+    std::map<uint64_t, Entry> m_entries;
+    qint64 m_cacheBytes = 0;
+};
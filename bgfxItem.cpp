@@ -1,307 +1,2469 @@
 #include "bgfxItem.h"
 
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
 #include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QWaitCondition>
 #include <QtQuick/QQuickWindow>
+#include <QtQuick/QSGSimpleTextureNode>
+#include <QOffscreenSurface>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 #include <QOpenGLExtraFunctions>
-#include <QtPlatformHeaders/QWGLNativeContext>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
 #include <d3d11.h>
+#endif
 #include <bx/bx.h>
 #include <bgfx/bgfx.h>
 #include <bgfx/platform.h>
-
+#include <bx/allocator.h>
+#include <bx/hash.h>
+#include <bx/timer.h>
+
+#include "atlasPacker.h"
+#include "bgfxCallback.h"
+#include "captureSink.h"
+#include "embeddedShaders.h"
+#include "frameStats.h"
+#include "nativeContext.h"
+#include "resourceLoader.h"
+
+#ifdef _WIN32
 #define HRESULT_CHECK(call_) do { HRESULT result_ = call_;	assert(result_ == S_OK); } while(0);
 #define SAFE_RELEASE(p) { if ( (p) ) { (p)->Release(); (p) = 0; } }
+#endif
 
 #define GL_CHECK() assert(gl->glGetError() == 0);
 
+Q_LOGGING_CATEGORY(lcBgfx, "bgfx")
+Q_LOGGING_CATEGORY(lcBgfxCache, "bgfx.cache")
+
+/******************************************************************************/
+// bgfx API thread used in ThreadingMode::MultiThread and WorkerThread.
+// Jobs are executed in submission order, a null job stops the thread.
+class bgfxApiThread : public QThread
+{
+public:
+    void post(std::function<void()> pJob)
+    {
+        QMutexLocker lock(&m_mutex);
+        m_jobs.push_back(std::move(pJob));
+        m_jobAvailable.wakeOne();
+    }
+
+protected:
+    void run() override
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                QMutexLocker lock(&m_mutex);
+                while (m_jobs.empty())
+                    m_jobAvailable.wait(&m_mutex);
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            if (!job)
+                return;
+            job();
+        }
+    }
+
+private:
+    QMutex m_mutex;
+    QWaitCondition m_jobAvailable;
+    std::deque<std::function<void()>> m_jobs;
+};
+
+/******************************************************************************/
+class FunctionJob : public QRunnable
+{
+public:
+    FunctionJob(std::function<void()> pJob) : mJob(std::move(pJob)) { }
+    void run() override { mJob(); }
+private:
+    std::function<void()> mJob;
+};
+
+/******************************************************************************/
+// bgfx allocator counting allocations, for benchmarks
+class CountingAllocator : public bx::AllocatorI
+{
+public:
+    void* realloc(void* _ptr, size_t _size, size_t _align, const char* _file, uint32_t _line) override
+    {
+        if (_size != 0)
+            ++m_count;
+        return m_allocator.realloc(_ptr, _size, _align, _file, _line);
+    }
+
+    std::atomic<uint64_t> m_count{ 0 };
+
+private:
+    bx::DefaultAllocator m_allocator;
+};
+
+/******************************************************************************/
+// Offscreen render target formats, see BgfxItem::samples()
+struct RenderTargetConfig
+{
+    uint32_t samples = 1;
+    bgfx::TextureFormat::Enum color = bgfx::TextureFormat::RGBA8;
+    bgfx::TextureFormat::Enum depth = bgfx::TextureFormat::D24S8;
+    bool depthWriteOnly = false;
+
+    bool operator==(const RenderTargetConfig& pOther) const
+    {
+        return std::tie(samples, color, depth, depthWriteOnly) == std::tie(pOther.samples, pOther.color, pOther.depth, pOther.depthWriteOnly);
+    }
+    bool operator!=(const RenderTargetConfig& pOther) const { return !(*this == pOther); }
+
+    // An MSAA color texture is rendered into a multisampled buffer, bgfx resolves it into
+    // the texture itself (the one Qt copies or samples) when the frame buffer is done
+    uint64_t colorFlags() const
+    {
+        switch (samples)
+        {
+        case 2: return BGFX_TEXTURE_RT_MSAA_X2;
+        case 4: return BGFX_TEXTURE_RT_MSAA_X4;
+        case 8: return BGFX_TEXTURE_RT_MSAA_X8;
+        case 16: return BGFX_TEXTURE_RT_MSAA_X16;
+        default: return BGFX_TEXTURE_RT;
+        }
+    }
+
+    // A write only depth is a render buffer, never resolved
+    uint64_t depthFlags() const { return colorFlags() | (depthWriteOnly ? BGFX_TEXTURE_RT_WRITE_ONLY : 0); }
+
+    // Falls back to what the renderer can render to, after bgfx::init()
+    RenderTargetConfig supported() const
+    {
+        RenderTargetConfig config = *this;
+        if (bgfx::getRendererType() == bgfx::RendererType::Noop)
+            return config;
+
+        const bgfx::Caps* caps = bgfx::getCaps();
+        // Direct3D11 interop copies and wraps the target as RGBA8
+        if (config.color != bgfx::TextureFormat::RGBA8
+            && (bgfx::getRendererType() == bgfx::RendererType::Direct3D11 || !(caps->formats[config.color] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER)))
+        {
+            qWarning("bgfx offscreen color format unsupported, fallback to RGBA8");
+            config.color = bgfx::TextureFormat::RGBA8;
+        }
+        if (config.depth != bgfx::TextureFormat::D24S8 && !(caps->formats[config.depth] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER))
+        {
+            qWarning("bgfx offscreen depth format unsupported, fallback to D24S8");
+            config.depth = bgfx::TextureFormat::D24S8;
+        }
+        // bgfx clamps the sample count to the device maximum
+        if (config.samples > 1
+            && (!(caps->formats[config.color] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER_MSAA) || !(caps->formats[config.depth] & BGFX_CAPS_FORMAT_TEXTURE_FRAMEBUFFER_MSAA)))
+        {
+            qWarning("bgfx offscreen MSAA unsupported for these formats, fallback to 1 sample");
+            config.samples = 1;
+        }
+        return config;
+    }
+};
+
 /******************************************************************************/
 struct bgfxRendererGlobal
 {
     bool m_initialized = false;
     bgfx::RendererType::Enum m_backend;
     InteropMode::Enum m_interopMode;
+    ThreadingMode::Enum m_threadingMode = ThreadingMode::SingleThread;
+    uint32_t m_maxInstancedGrid = 0;    // InitQt_BGFX_Backend(), sizes the transient vertex buffer
     void* m_context = nullptr;
-    void init(void* pContext)
+    bgfxApiThread* m_apiThread = nullptr;
+    QThreadPool* m_recordPool = nullptr;
+    QMutex m_initMutex;     // Qt's threaded render loop calls init() from every window's render thread
+    CountingAllocator m_allocator;
+    bgfxCallback m_callback;
+    bgfxResourceLoader m_loader;
+
+    // Decoded resources created per bgfx frame, see bgfxResourceLoader::processUploads()
+    static const uint32_t UploadBudgetBytes = 4 * 1024 * 1024;
+
+    // Transient vertex memory per frame, instance data included. bgfx's default (6 MB,
+    // double buffered in MultiThread mode) holds ~98k instance matrices: only grown for the
+    // instanced grid requested at init, plus headroom for the other transient data. The
+    // draw call and transform cache limits are bgfx build options (BGFX_CONFIG_MAX_DRAW_CALLS).
+    static const uint32_t InstanceMatrixBytes = 64;
+    static const uint32_t TransientVbHeadroomBytes = 1024 * 1024;
+    uint32_t transientVbSize(uint32_t pDefault) const
     {
-        if (!m_initialized)
+        const uint64_t instanced = uint64_t(m_maxInstancedGrid) * m_maxInstancedGrid * InstanceMatrixBytes;
+        if (instanced == 0 || instanced + TransientVbHeadroomBytes <= pDefault)
+            return pDefault;
+        return uint32_t(std::min<uint64_t>(instanced + TransientVbHeadroomBytes, UINT32_MAX));
+    }
+
+    // --- WorkerThread mode
+    // Qt's threaded render loop gives each window its own render thread and context,
+    // none of them can be the bgfx render thread. bgfx renders on the API thread in a
+    // context of Qt's share group instead, the windows composite its textures.
+    QOpenGLContext* m_workerContext = nullptr;
+    QOffscreenSurface* m_workerSurface = nullptr;
+
+    // GL fence of each frame submitted by the worker, oldest first. Polled from the
+    // windows' contexts (same share group) to publish the frames the GPU completed.
+    static const size_t MaxFrameFences = 4;
+    static const GLuint64 FrameFenceTimeoutNs = 1000 * 1000 * 1000;
+    QMutex m_frameFencesMutex;
+    std::deque<std::pair<uint32_t, GLsync>> m_frameFences;
+    std::atomic<uint32_t> m_completedFrames{ 0 };   // submitted frames completed by the GPU
+
+    // Worker thread, after bgfx::frame()
+    void insertFrameFence()
+    {
+        QOpenGLExtraFunctions* gl = m_workerContext->extraFunctions();
+        const GLsync sync = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        gl->glFlush(); // for the other contexts to see it signal
+        QMutexLocker lock(&m_frameFencesMutex);
+        m_frameFences.emplace_back(m_submittedFrames, sync);
+        // Don't run more frames ahead of the GPU than the windows can queue
+        while (m_frameFences.size() > MaxFrameFences)
+        {
+            gl->glClientWaitSync(m_frameFences.front().second, 0, FrameFenceTimeoutNs);
+            popFrameFence(gl);
+        }
+    }
+
+    // Last frame completed by the GPU, from a context of the share group
+    uint32_t pollFrameFences(QOpenGLExtraFunctions* pGl)
+    {
+        QMutexLocker lock(&m_frameFencesMutex);
+        while (!m_frameFences.empty())
         {
-            m_context = pContext;
+            const GLenum status = pGl->glClientWaitSync(m_frameFences.front().second, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            popFrameFence(pGl);
+        }
+        return m_completedFrames;
+    }
+
+    void popFrameFence(QOpenGLExtraFunctions* pGl)
+    {
+        pGl->glDeleteSync(m_frameFences.front().second);
+        m_completedFrames = m_frameFences.front().first;
+        m_frameFences.pop_front();
+    }
+
+    // From the GUI thread (QOffscreenSurface), before any window renders
+    void startWorker()
+    {
+        m_apiThread = new bgfxApiThread;
+        m_apiThread->start();
+        if (m_backend != bgfx::RendererType::OpenGL)
+            return;
+
+        if (!QOpenGLContext::globalShareContext())
+            qWarning("bgfx WorkerThread mode requires Qt::AA_ShareOpenGLContexts");
+        m_workerSurface = new QOffscreenSurface;
+        m_workerSurface->setFormat(QSurfaceFormat::defaultFormat());
+        m_workerSurface->create();
+        m_workerContext = new QOpenGLContext;
+        m_workerContext->setFormat(QSurfaceFormat::defaultFormat());
+        m_workerContext->setShareContext(QOpenGLContext::globalShareContext());
+        if (!m_workerContext->create())
+            qWarning("Can't create the bgfx worker GL context");
+        m_workerContext->moveToThread(m_apiThread);
+        post([this] { m_workerContext->makeCurrent(m_workerSurface); });
+    }
 
+    // Must be called from Qt's render thread. pDisplay is the X11 display with GLX
+    void init(void* pContext, void* pDisplay = nullptr)
+    {
+        QMutexLocker lock(&m_initMutex);
+        if (!m_initialized)
+        {
             bgfx::Init init;
             init.type = m_backend;
-            init.platformData.context = pContext;   // D3DDevice
-            bgfx::renderFrame();                    // switch bgfx to singlethread rendering
-            bgfx::init(init);
+            init.allocator = &m_allocator;
+            init.callback = &m_callback;
+            init.limits.transientVbSize = transientVbSize(init.limits.transientVbSize);
+
+            if (m_threadingMode == ThreadingMode::WorkerThread)
+            {
+                // The API thread is the render thread too, in the worker context (null for Noop)
+                call([this, init]() mutable
+                {
+                    const NativeGLContext native = m_workerContext ? nativeGLContext(m_workerContext) : NativeGLContext();
+                    m_context = native.context;
+                    init.platformData.context = native.context;
+                    init.platformData.ndt = native.display;
+                    m_callback.openCache(m_backend, driverIdentifier(m_context));
+                    bgfx::renderFrame();
+                    bgfx::init(init);
+                    m_usedViews.assign(bgfx::getCaps()->limits.maxViews, false);
+                });
+            }
+            else
+            {
+                m_context = pContext;
+                init.platformData.context = pContext;   // D3DDevice
+                init.platformData.ndt = pDisplay;
+                m_callback.openCache(m_backend, driverIdentifier(pContext));
+
+                // Calling renderFrame() before init() makes this thread the bgfx render thread.
+                // In SingleThread mode init() is called from the same thread: bgfx switches to
+                // singlethread rendering. In MultiThread mode init() is called from the API thread.
+                bgfx::renderFrame();
+                if (m_threadingMode == ThreadingMode::MultiThread)
+                {
+                    m_apiThread = new bgfxApiThread;
+                    m_apiThread->start();
+                }
+
+                call([this, init]
+                {
+                    bgfx::init(init);
+
+                    // Don't work with offscreen rendering
+                    //bgfx::setDebug(BGFX_DEBUG_TEXT | BGFX_DEBUG_STATS);
+
+                    m_usedViews.assign(bgfx::getCaps()->limits.maxViews, false);
+                });
+            }
 
-            // Don't work with offscreen rendering
-            //bgfx::setDebug(BGFX_DEBUG_TEXT | BGFX_DEBUG_STATS);
+            m_recordPool = new QThreadPool;
 
             m_initialized = true;
         }
-        assert(m_context == pContext); // should not be change
+        // should not be change, windows have their own context in WorkerThread mode
+        assert(m_threadingMode == ThreadingMode::WorkerThread || m_context == pContext);
+    }
+
+    // Device and driver version, from the thread initializing bgfx (GL context current)
+    QByteArray driverIdentifier(void* pContext) const
+    {
+        QByteArray driver;
+#ifdef _WIN32
+        if (m_backend == bgfx::RendererType::Direct3D11)
+        {
+            IDXGIDevice* dxgiDevice = nullptr;
+            IDXGIAdapter* adapter = nullptr;
+            DXGI_ADAPTER_DESC desc = {};
+            LARGE_INTEGER version = {};
+            if (SUCCEEDED(static_cast<ID3D11Device*>(pContext)->QueryInterface(__uuidof(IDXGIDevice), (void**)&dxgiDevice))
+                && SUCCEEDED(dxgiDevice->GetAdapter(&adapter)))
+            {
+                adapter->GetDesc(&desc);
+                adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &version);
+            }
+            SAFE_RELEASE(adapter);
+            SAFE_RELEASE(dxgiDevice);
+            driver = QString("%1 %2:%3 %4").arg(QString::fromWCharArray(desc.Description))
+                .arg(desc.VendorId, 4, 16, QLatin1Char('0')).arg(desc.DeviceId, 4, 16, QLatin1Char('0'))
+                .arg(version.QuadPart).toUtf8();
+        }
+        else
+#else
+        Q_UNUSED(pContext);
+#endif
+        if (QOpenGLContext* context = QOpenGLContext::currentContext())
+        {
+            // GL_VERSION contains the driver version
+            QOpenGLFunctions* gl = context->functions();
+            driver = QByteArray(reinterpret_cast<const char*>(gl->glGetString(GL_VENDOR))) + ' '
+                + reinterpret_cast<const char*>(gl->glGetString(GL_RENDERER)) + ' '
+                + reinterpret_cast<const char*>(gl->glGetString(GL_VERSION));
+        }
+        qCDebug(lcBgfx, "Driver %s", driver.constData());
+        return driver;
     }
 
     void shutdown()
     {
         if (m_initialized)
         {
-            bgfx::shutdown();
+            call([this]
+            {
+                m_loader.shutdown();
+                m_sharedStreams.clear();
+                destroyShared();
+                bgfx::shutdown();
+                m_orphanReadbacks.clear();
+                m_atlasRegions.clear();
+                m_atlasPages.clear();
+                m_atlasDepth = BGFX_INVALID_HANDLE;
+            });
+            m_initialized = false;
+        }
+
+        delete m_recordPool;
+        m_recordPool = nullptr;
+
+        if (m_workerContext)
+        {
+            // Destroyed below on the GUI thread, with the surface
+            call([this]
+            {
+                QMutexLocker lock(&m_frameFencesMutex);
+                while (!m_frameFences.empty())
+                    popFrameFence(m_workerContext->extraFunctions());
+                m_workerContext->doneCurrent();
+                m_workerContext->moveToThread(QCoreApplication::instance()->thread());
+            });
+        }
+
+        if (m_apiThread)
+        {
+            m_apiThread->post(nullptr);
+            m_apiThread->wait();
+            delete m_apiThread;
+            m_apiThread = nullptr;
         }
+
+        delete m_workerContext;
+        m_workerContext = nullptr;
+        delete m_workerSurface;
+        m_workerSurface = nullptr;
     }
-};
-static bgfxRendererGlobal bgfxGlobal;
 
+    // --- API thread dispatch
+    // In SingleThread mode jobs are run inline. In MultiThread mode post() queues the job
+    // on the API thread and returns, call() waits for its completion while executing the
+    // frames the API thread submits meanwhile (it may be blocked in bgfx::frame()).
+    // In WorkerThread mode the API thread executes its frames, call() only waits. Both
+    // can be used from several render threads.
+    void post(std::function<void()> pJob)
+    {
+        if (m_apiThread)
+            m_apiThread->post(std::move(pJob));
+        else
+            pJob();
+    }
 
-/******************************************************************************/
-// ugly but it's to get bgfxGlobal access in cubes.h
-#include "cubes.h"
+    void call(const std::function<void()>& pJob)
+    {
+        if (!m_apiThread)
+        {
+            pJob();
+            return;
+        }
 
-/******************************************************************************/
-// Initialize BGFX
-bool InitQt_BGFX_Backend(QSGRendererInterface::GraphicsApi pBackend, InteropMode::Enum pInteropMode)
-{
-    //QRhiD3D11InitParams params;
-    //params.enableDebugLayer = true;
-    //rhi = QRhi::create(QRhi::D3D11, &params);
+        if (m_threadingMode == ThreadingMode::WorkerThread)
+        {
+            QSemaphore done;
+            m_apiThread->post([&pJob, &done] { pJob(); done.release(); });
+            done.acquire();
+            return;
+        }
 
-    assert(bgfxGlobal.m_initialized == false);
-    QSGRendererInterface::GraphicsApi lBackend = pBackend == QSGRendererInterface::Direct3D11Rhi ? QSGRendererInterface::Direct3D11Rhi : QSGRendererInterface::OpenGLRhi;    
-    QQuickWindow::setSceneGraphBackend(lBackend);
-    bgfxGlobal.m_interopMode = pInteropMode;
-    bgfxGlobal.m_backend = lBackend == QSGRendererInterface::Direct3D11Rhi ? bgfx::RendererType::Direct3D11 : bgfx::RendererType::OpenGL;
-    return true;
-}
+        std::atomic<bool> done(false);
+        m_apiThread->post([&pJob, &done] { pJob(); done = true; });
+        while (!done)
+        {
+            if (bgfx::renderFrame(1) == bgfx::RenderFrame::NoContext)
+                QThread::yieldCurrentThread();
+        }
+    }
 
-/******************************************************************************/
-void FinalizeQt_BGFX_Backend()
-{
-    bgfxGlobal.shutdown();
-}
+    // --- Parallel recording
+    // Split [0, pCount) in chunks of at least pMinChunk elements run concurrently on the
+    // record pool, blocks until every chunk is done. The number of chunks is bounded by
+    // the bgfx encoder count, minus the API thread and the item encoders.
+    uint32_t chunkCount(uint32_t pCount, uint32_t pMinChunk) const
+    {
+        const uint32_t maxEncoders = bgfx::getCaps()->limits.maxEncoders;
+        const uint32_t maxChunks = std::min<uint32_t>(maxEncoders > 2 ? maxEncoders - 2 : 1, uint32_t(m_recordPool->maxThreadCount()));
+        return std::max<uint32_t>(1, std::min<uint32_t>(maxChunks, pCount / std::max<uint32_t>(pMinChunk, 1)));
+    }
 
-/******************************************************************************/
-class bgfxRenderer : public QObject
-{
-    Q_OBJECT
-public:
-    bgfxRenderer();
-    ~bgfxRenderer();
+    void parallelFor(uint32_t pCount, uint32_t pMinChunk, const std::function<void(uint32_t, uint32_t)>& pJob)
+    {
+        const uint32_t numChunks = chunkCount(pCount, pMinChunk);
+        if (numChunks <= 1)
+        {
+            pJob(0, pCount);
+            return;
+        }
 
-    void setViewportSize(const QSize &size)
+        QSemaphore done;
+        for (uint32_t ii = 1; ii < numChunks; ++ii)
+        {
+            const uint32_t first = uint32_t(uint64_t(pCount) * ii / numChunks);
+            const uint32_t last = uint32_t(uint64_t(pCount) * (ii + 1) / numChunks);
+            m_recordPool->start(new FunctionJob([&pJob, &done, first, last] { pJob(first, last); done.release(); }));
+        }
+        // The calling thread takes the first chunk
+        pJob(0, uint32_t(uint64_t(pCount) / numChunks));
+        done.acquire(numChunks - 1);
+    }
+
+    // Same as parallelFor() with a bgfx::Encoder per chunk. A single chunk is recorded
+    // inline through pEncoder.
+    void parallelRecord(uint32_t pCount, uint32_t pMinChunk, bgfx::Encoder* pEncoder, const std::function<void(bgfx::Encoder*, uint32_t, uint32_t)>& pJob)
     {
-        if
-            (m_viewportSize != size)
+        if (chunkCount(pCount, pMinChunk) <= 1)
         {
-            m_viewportSize = size;
+            pJob(pEncoder, 0, pCount);
+            return;
+        }
+
+        parallelFor(pCount, pMinChunk, [&pJob](uint32_t pFirst, uint32_t pLast)
+        {
+            bgfx::Encoder* encoder = bgfx::begin(true);
+            assert(encoder); // chunk count is bounded by the encoder count
+            pJob(encoder, pFirst, pLast);
+            bgfx::end(encoder);
+        });
+    }
+
+    // --- View ID allocator
+    // Each bgfxRenderer owns a private contiguous range of bgfx views, so several
+    // items can be recorded into the same bgfx frame without overriding each
+    // other's framebuffer, clear or transform state.
+    static const bgfx::ViewId InvalidView = UINT16_MAX;
+    std::vector<bool> m_usedViews;
+
+    bgfx::ViewId allocViews(uint16_t pCount)
+    {
+        assert(m_initialized && pCount > 0);
+        const uint32_t maxViews = uint32_t(m_usedViews.size());
+        uint32_t first = 0;
+        while (first + pCount <= maxViews)
+        {
+            uint32_t ii = 0;
+            while (ii < pCount && !m_usedViews[first + ii])
+                ++ii;
 
+            if (ii == pCount)
+            {
+                for (ii = 0; ii < pCount; ++ii)
+                    m_usedViews[first + ii] = true;
+                return bgfx::ViewId(first);
+            }
+            first += ii + 1; // restart after the used view
+        }
+        qWarning("bgfx view allocator exhausted (%u views requested)", pCount);
+        return InvalidView;
+    }
+
+    void freeViews(bgfx::ViewId pFirst, uint16_t pCount)
+    {
+        if (pFirst == InvalidView)
+            return;
+
+        for (uint32_t ii = pFirst; ii < uint32_t(pFirst) + pCount; ++ii)
+        {
+            assert(m_usedViews[ii]);
+            m_usedViews[ii] = false;
             if (m_initialized)
+                bgfx::resetView(bgfx::ViewId(ii));
+        }
+    }
+
+    // OffscreenFramebuffer, TextureNode and TextureAtlas render into a bgfx::Framebuffer
+    bool rendersOffscreen() const
+    {
+        return m_interopMode == InteropMode::OffscreenFramebuffer || samplesOffscreen();
+    }
+
+    // TextureNode and TextureAtlas let the scene graph sample the offscreen target
+    bool samplesOffscreen() const
+    {
+        return m_interopMode == InteropMode::TextureNode || m_interopMode == InteropMode::TextureAtlas;
+    }
+
+    // --- Texture atlas (InteropMode::TextureAtlas)
+    // Items render into regions of render targets shared by every renderer: one
+    // target for many small items instead of a window sized one each. A renderer with
+    // a ring of N targets uses pages [0, N), at the same region in each page. The
+    // depth buffer is shared by the pages. When a region doesn't fit, the pages grow
+    // and every region is packed again, their owners are told through their moved
+    // callback (the content is lost, they record again). API thread.
+    static const int AtlasInitialSize = 1024;
+    static const int AtlasMaxSize = 4096;
+
+    struct AtlasPage
+    {
+        bgfx::FrameBufferHandle fb = BGFX_INVALID_HANDLE;
+        bgfx::TextureHandle color = BGFX_INVALID_HANDLE;
+    };
+
+    struct AtlasRegion
+    {
+        QRect rect;                     // in bgfx view coordinates, top-left origin
+        int pageCount;
+        std::function<void()> moved;
+    };
+
+    AtlasPacker m_atlasPacker;
+    RenderTargetConfig m_atlasConfig;       // of the pages, set by the first region
+    std::vector<AtlasPage> m_atlasPages;
+    bgfx::TextureHandle m_atlasDepth = BGFX_INVALID_HANDLE;
+    std::map<int, AtlasRegion> m_atlasRegions;
+    int m_nextAtlasRegion = 0;
+
+    QSize atlasSize() const { return m_atlasPacker.size(); }
+    int atlasMaxSize() const { return std::min<int>(AtlasMaxSize, bgfx::getCaps()->limits.maxTextureSize); }
+    QRect atlasRect(int pRegion) const { return m_atlasRegions.at(pRegion).rect; }
+    const AtlasPage& atlasPage(int pPage) const { return m_atlasPages[pPage]; }
+
+    // Region of pSize in the first pPageCount pages, -1 if it doesn't fit in the largest atlas
+    // or the pages have another pConfig
+    int allocAtlasRegion(const QSize& pSize, int pPageCount, const RenderTargetConfig& pConfig, std::function<void()> pMoved)
+    {
+        const int maxSize = atlasMaxSize();
+        if (pSize.width() > maxSize || pSize.height() > maxSize)
+            return -1;
+        if (pConfig != m_atlasConfig)
+        {
+            if (!m_atlasRegions.empty())
+                return -1;
+            destroyAtlasPages();
+            m_atlasConfig = pConfig;
+        }
+
+        if (m_atlasPages.empty())
+            m_atlasPacker.reset(QSize(AtlasInitialSize, AtlasInitialSize).boundedTo(QSize(maxSize, maxSize)));
+
+        QRect rect;
+        bool moved = false;
+        if (!m_atlasPacker.alloc(pSize, rect))
+        {
+            // Pack every region again in a larger atlas, the tallest first
+            std::vector<std::pair<int, AtlasRegion*>> regions;
+            for (auto& region : m_atlasRegions)
+                regions.emplace_back(region.first, &region.second);
+            std::sort(regions.begin(), regions.end(), [](const std::pair<int, AtlasRegion*>& pA, const std::pair<int, AtlasRegion*>& pB)
             {
-                resize();
+                return pA.second->rect.height() > pB.second->rect.height();
+            });
+
+            std::vector<QRect> packed(regions.size());
+            AtlasPacker packer;
+            bool fits = false;
+            for (int size = m_atlasPacker.size().width() * 2; size <= maxSize && !fits; size *= 2)
+            {
+                packer.reset(QSize(size, size));
+                fits = true;
+                for (size_t ii = 0; ii < regions.size() && fits; ++ii)
+                    fits = packer.alloc(regions[ii].second->rect.size(), packed[ii]);
+                fits = fits && packer.alloc(pSize, rect);
             }
+            if (!fits)
+                return -1;
+
+            m_atlasPacker = packer;
+            for (size_t ii = 0; ii < regions.size(); ++ii)
+                regions[ii].second->rect = packed[ii];
+            destroyAtlasPages();
+            moved = true;
+        }
+        int pageCount = pPageCount;
+        for (const auto& region : m_atlasRegions)
+            pageCount = std::max(pageCount, region.second.pageCount);
+        createAtlasPages(pageCount);
+
+        const int id = m_nextAtlasRegion++;
+        if (moved)
+        {
+            for (auto& region : m_atlasRegions)
+                region.second.moved();
         }
+        m_atlasRegions[id] = AtlasRegion{ rect, pPageCount, std::move(pMoved) };
+        return id;
     }
-    void setWindow(QQuickWindow *window) { m_window = window; }
 
-public slots:
-    void frameStart();
-    void mainPassRecordingStart();
+    void freeAtlasRegion(int pRegion)
+    {
+        auto region = m_atlasRegions.find(pRegion);
+        if (region == m_atlasRegions.end())
+            return;
+        m_atlasPacker.free(region->second.rect);
+        m_atlasRegions.erase(region);
+    }
 
-private:
-    InteropMode::Enum m_interopMode = InteropMode::OffscreenFramebuffer;
+    // Release the pages once no renderer uses them, kept while regions are reallocated
+    void trimAtlas()
+    {
+        if (m_atlasRegions.empty())
+            destroyAtlasPages();
+    }
 
-    void resize();
-    void render_Common(); // render bgfx stuff
+    void createAtlasPages(int pPageCount)
+    {
+        const QSize size = m_atlasPacker.size();
+        if (!bgfx::isValid(m_atlasDepth))
+            m_atlasDepth = bgfx::createTexture2D(uint16_t(size.width()), uint16_t(size.height()), false, 1, m_atlasConfig.depth, m_atlasConfig.depthFlags(), NULL);
+        while (int(m_atlasPages.size()) < pPageCount)
+        {
+            AtlasPage page;
+            page.color = bgfx::createTexture2D(uint16_t(size.width()), uint16_t(size.height()), false, 1, m_atlasConfig.color, m_atlasConfig.colorFlags(), NULL);
+            bgfx::TextureHandle fbtextures[2] = { page.color, m_atlasDepth };
+            page.fb = bgfx::createFrameBuffer(BX_COUNTOF(fbtextures), fbtextures, false);
+            m_atlasPages.push_back(page);
+        }
+    }
 
-    void render_ExternPlatform_DX11();             // Use platformData to set backBuffer
-    void render_SynchroFramebuffer_DX11();         // Create a bgfx::Framebuffer synchronized with extern Texture handle given by Qt
-    void render_OffscreenFramebuffer_DX11();       // Create a bgfx::Framebuffer, render to it, then blit result
+    void destroyAtlasPages()
+    {
+        for (const AtlasPage& page : m_atlasPages)
+        {
+            bgfx::destroy(page.fb);
+            bgfx::destroy(page.color);
+        }
+        m_atlasPages.clear();
+        if (bgfx::isValid(m_atlasDepth))
+            bgfx::destroy(m_atlasDepth);
+        m_atlasDepth = BGFX_INVALID_HANDLE;
+    }
 
-    void resize_ExternPlatform_DX11();
-    void resize_SynchroFramebuffer_DX11();
-    void resize_OffscreenFramebuffer_DX11();
+    // --- Shared resources
+    // Programs and static meshes are shared by every renderer. They are keyed by a hash
+    // of their content, so the 2nd..Nth item reuses the GPU objects created for the
+    // first one. Reference counted, acquire*() and release() on the API thread.
+    enum SharedType : uint32_t { SharedProgram, SharedVertexBuffer, SharedIndexBuffer };
 
+    struct SharedKey
+    {
+        uint32_t type;
+        uint32_t size;  // content size, with the hash against collisions
+        uint32_t hash;
+        bool operator<(const SharedKey& pOther) const
+        {
+            return std::tie(type, size, hash) < std::tie(pOther.type, pOther.size, pOther.hash);
+        }
+    };
 
-    void render_ExternPlatform_GL();             // Use platformData to set backBuffer
-    void render_SynchroFramebuffer_GL();         // Create a bgfx::Framebuffer synchronized with extern Texture handle given by Qt
-    void render_OffscreenFramebuffer_GL();       // Create a bgfx::Framebuffer, render to it, then blit result
+    struct SharedEntry
+    {
+        uint16_t idx;   // bgfx handle index
+        uint32_t refCount;
+    };
+
+    std::map<SharedKey, SharedEntry> m_shared;
+    std::map<std::pair<uint32_t, uint16_t>, SharedKey> m_sharedKeys; // (type, idx) -> key, for release()
+
+    template<typename Handle, typename Create>
+    Handle acquireShared(SharedType pType, uint32_t pHash, uint32_t pSize, const Create& pCreate)
+    {
+        const SharedKey key = { pType, pSize, pHash };
+        auto found = m_shared.find(key);
+        if (found != m_shared.end())
+        {
+            ++found->second.refCount;
+            Handle handle = { found->second.idx };
+            return handle;
+        }
+
+        Handle handle = pCreate();
+        if (bgfx::isValid(handle))
+        {
+            m_shared[key] = { handle.idx, 1 };
+            m_sharedKeys[std::make_pair(uint32_t(pType), handle.idx)] = key;
+        }
+        return handle;
+    }
+
+    template<typename Handle>
+    void releaseShared(SharedType pType, Handle pHandle)
+    {
+        if (!bgfx::isValid(pHandle))
+            return;
+
+        auto key = m_sharedKeys.find(std::make_pair(uint32_t(pType), pHandle.idx));
+        assert(key != m_sharedKeys.end()); // not acquired from the cache
+        if (key == m_sharedKeys.end())
+            return;
+
+        auto entry = m_shared.find(key->second);
+        if (--entry->second.refCount == 0)
+        {
+            bgfx::destroy(pHandle);
+            m_shared.erase(entry);
+            m_sharedKeys.erase(key);
+        }
+    }
+
+    // pVsName/pFsName are embedded shader names without .sc, e.g. "cubes.vert"
+    bgfx::ProgramHandle acquireProgram(const char* pVsName, const char* pFsName)
+    {
+        const EmbeddedShaderBinary* vs = findEmbeddedShader(pVsName, m_backend);
+        const EmbeddedShaderBinary* fs = findEmbeddedShader(pFsName, m_backend);
+        if (!vs || !fs)
+        {
+            qWarning("Program %s + %s isn't embedded for %s", pVsName, pFsName, bgfx::getRendererName(m_backend));
+            return BGFX_INVALID_HANDLE;
+        }
+
+        bx::HashMurmur2A murmur;
+        murmur.begin();
+        murmur.add(vs->data, int(vs->size));
+        murmur.add(fs->data, int(fs->size));
+        murmur.add(m_backend);
+        return acquireShared<bgfx::ProgramHandle>(SharedProgram, murmur.end(), vs->size + fs->size, [&]
+        {
+            return bgfx::createProgram(createEmbeddedShader(pVsName, m_backend), createEmbeddedShader(pFsName, m_backend), true);
+        });
+    }
+
+    // pCsName is an embedded compute shader name without .sc, e.g. "hiz_copy.comp"
+    bgfx::ProgramHandle acquireComputeProgram(const char* pCsName)
+    {
+        const EmbeddedShaderBinary* cs = findEmbeddedShader(pCsName, m_backend);
+        if (!cs)
+        {
+            qWarning("Compute program %s isn't embedded for %s", pCsName, bgfx::getRendererName(m_backend));
+            return BGFX_INVALID_HANDLE;
+        }
+
+        bx::HashMurmur2A murmur;
+        murmur.begin();
+        murmur.add(cs->data, int(cs->size));
+        murmur.add(m_backend);
+        return acquireShared<bgfx::ProgramHandle>(SharedProgram, murmur.end(), cs->size, [&]
+        {
+            return bgfx::createProgram(createEmbeddedShader(pCsName, m_backend), true);
+        });
+    }
+
+    // pData is referenced (bgfx::makeRef), it must be static
+    bgfx::VertexBufferHandle acquireVertexBuffer(const void* pData, uint32_t pSize, const bgfx::VertexLayout& pLayout)
+    {
+        bx::HashMurmur2A murmur;
+        murmur.begin();
+        murmur.add(pData, int(pSize));
+        murmur.add(pLayout.m_hash);
+        return acquireShared<bgfx::VertexBufferHandle>(SharedVertexBuffer, murmur.end(), pSize, [&]
+        {
+            return bgfx::createVertexBuffer(bgfx::makeRef(pData, pSize), pLayout);
+        });
+    }
+
+    // pData is referenced (bgfx::makeRef), it must be static
+    bgfx::IndexBufferHandle acquireIndexBuffer(const void* pData, uint32_t pSize)
+    {
+        return acquireShared<bgfx::IndexBufferHandle>(SharedIndexBuffer, bx::hash<bx::HashMurmur2A>(pData, pSize), pSize, [&]
+        {
+            return bgfx::createIndexBuffer(bgfx::makeRef(pData, pSize));
+        });
+    }
+
+    void release(bgfx::ProgramHandle pHandle) { releaseShared(SharedProgram, pHandle); }
+    void release(bgfx::VertexBufferHandle pHandle) { releaseShared(SharedVertexBuffer, pHandle); }
+    void release(bgfx::IndexBufferHandle pHandle) { releaseShared(SharedIndexBuffer, pHandle); }
+
+    // Streamed textures are shared by content hash (MipChain::hash) the same way. The
+    // stream uploads the finest level any of its users needs.
+    struct SharedStream
+    {
+        struct User
+        {
+            QSize targetSize;
+            std::function<void()> changed;
+        };
+        std::unique_ptr<TextureStream> stream;
+        std::map<const void*, User> users;
+    };
+    std::map<uint32_t, SharedStream> m_sharedStreams;
+
+    // pChanged is called when the displayed texture or its resident levels change
+    TextureStream* acquireStream(const void* pUser, std::shared_ptr<const MipChain> pMips, std::function<void()> pChanged)
+    {
+        const uint32_t hash = pMips->hash;
+        SharedStream& shared = m_sharedStreams[hash];
+        if (!shared.stream)
+        {
+            shared.stream.reset(new TextureStream(std::move(pMips), [this, hash]
+            {
+                for (const auto& user : m_sharedStreams[hash].users)
+                    user.second.changed();
+            }));
+            m_loader.addStream(shared.stream.get());
+        }
+        shared.users[pUser] = SharedStream::User{ QSize(), std::move(pChanged) };
+        return shared.stream.get();
+    }
+
+    void setStreamTargetSize(const void* pUser, TextureStream* pStream, const QSize& pSize)
+    {
+        SharedStream& shared = m_sharedStreams[pStream->hash()];
+        shared.users[pUser].targetSize = pSize;
+        QSize size;
+        for (const auto& user : shared.users)
+            size = size.expandedTo(user.second.targetSize);
+        pStream->setTargetSize(size);
+    }
+
+    void releaseStream(const void* pUser, TextureStream* pStream)
+    {
+        auto shared = m_sharedStreams.find(pStream->hash());
+        if (shared == m_sharedStreams.end())
+            return;
+        shared->second.users.erase(pUser);
+        if (shared->second.users.empty())
+        {
+            m_loader.removeStream(pStream);
+            m_sharedStreams.erase(shared);
+        }
+        else
+        {
+            // The finest level may not be needed anymore
+            setStreamTargetSize(shared->second.users.begin()->first, pStream, shared->second.users.begin()->second.targetSize);
+        }
+    }
+
+    // Resources not released by their owners, on shutdown
+    void destroyShared()
+    {
+        for (const auto& key : m_sharedKeys)
+        {
+            const uint16_t idx = key.first.second;
+            switch (key.first.first)
+            {
+            case SharedProgram: { bgfx::ProgramHandle handle = { idx }; bgfx::destroy(handle); } break;
+            case SharedVertexBuffer: { bgfx::VertexBufferHandle handle = { idx }; bgfx::destroy(handle); } break;
+            case SharedIndexBuffer: { bgfx::IndexBufferHandle handle = { idx }; bgfx::destroy(handle); } break;
+            }
+        }
+        m_shared.clear();
+        m_sharedKeys.clear();
+    }
+
+    // --- Frame coordinator
+    // Renderers record their views between beginRecording() and endRecording().
+    // When rendering offscreen bgfx::frame() is kicked once every registered
+    // renderer has recorded, so N windows cost a single bgfx frame per tick. Items
+    // composite the content of the last executed frame.
+    // Recordings of every window run on the API thread, so with one render thread per
+    // window this is also the barrier between them: a window rendering faster than the
+    // others records twice and flushes the tick without them.
+    // Other modes render straight into Qt's current render target, so their frame
+    // has to be flushed right away.
+    std::vector<const bgfxRenderer*> m_renderers;
+    std::vector<const bgfxRenderer*> m_recordedRenderers;
+    bool m_frameHasRecords = false;
+    uint32_t m_frameNumber = 0;
+    uint32_t m_submittedFrames = 0;                 // bgfx::frame() calls, API thread
+    std::atomic<uint32_t> m_executedFrames{ 0 };    // submitted frames executed by the render thread
+    FrameSample m_lastFrame;    // timings of the last bgfx::frame(), recordMs unused
+
+    // Buffers of bgfx::readTexture() calls still pending when their renderer was destroyed,
+    // bgfx writes them until the frame number they are available at
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> m_orphanReadbacks;
+
+    void orphanReadback(uint32_t pReadyFrame, std::vector<uint8_t>&& pBuffer)
+    {
+        m_orphanReadbacks.emplace_back(pReadyFrame, std::move(pBuffer));
+    }
+
+    void registerRenderer(const bgfxRenderer* pRenderer)
+    {
+        m_renderers.push_back(pRenderer);
+    }
+
+    void unregisterRenderer(const bgfxRenderer* pRenderer)
+    {
+        m_renderers.erase(std::remove(m_renderers.begin(), m_renderers.end(), pRenderer), m_renderers.end());
+        m_recordedRenderers.erase(std::remove(m_recordedRenderers.begin(), m_recordedRenderers.end(), pRenderer), m_recordedRenderers.end());
+    }
+
+    void beginRecording(const bgfxRenderer* pRenderer)
+    {
+        // A renderer is recording twice before every item did (hidden window, item
+        // not updated ...): don't wait for the others, start a new tick.
+        if (std::find(m_recordedRenderers.begin(), m_recordedRenderers.end(), pRenderer) != m_recordedRenderers.end())
+        {
+            flushFrame();
+        }
+    }
+
+    // pRecorded is false when the renderer reuses its last frame: it still counts for
+    // the tick, but a tick without any recording doesn't kick bgfx::frame()
+    void endRecording(const bgfxRenderer* pRenderer, bool pRecorded = true)
+    {
+        m_frameHasRecords |= pRecorded;
+        m_recordedRenderers.push_back(pRenderer);
+        if (!rendersOffscreen()
+            || m_recordedRenderers.size() >= m_renderers.size())
+        {
+            flushFrame();
+        }
+    }
+
+    void flushFrame()
+    {
+        m_loader.processUploads(UploadBudgetBytes);
+
+        // Advance to next frame. Rendering thread will be kicked to
+        // process submitted rendering primitives.
+        if (m_frameHasRecords)
+        {
+            const int64_t start = bx::getHPCounter();
+            m_frameNumber = bgfx::frame();
+            m_orphanReadbacks.erase(std::remove_if(m_orphanReadbacks.begin(), m_orphanReadbacks.end(),
+                [this](const std::pair<uint32_t, std::vector<uint8_t>>& pReadback) { return int32_t(m_frameNumber - pReadback.first) >= 0; }),
+                m_orphanReadbacks.end());
+            // In MultiThread mode bgfx::frame() returns once the render thread executed the
+            // previous frame, in SingleThread and WorkerThread modes the frame is executed
+            // before it returns
+            ++m_submittedFrames;
+            if (m_workerContext)
+            {
+                // Composited from the windows' contexts once the GPU completed it, see
+                // bgfxRenderer::updateTargets()
+                insertFrameFence();
+            }
+            m_executedFrames = m_threadingMode == ThreadingMode::MultiThread ? m_submittedFrames - 1 : m_submittedFrames;
+            const double toMs = 1000.0 / double(bx::getHPFrequency());
+
+            const bgfx::Stats* stats = bgfx::getStats();
+            const double cpuToMs = 1000.0 / double(stats->cpuTimerFreq);
+            m_lastFrame.frame = m_frameNumber;
+            m_lastFrame.frameMs = float((bx::getHPCounter() - start) * toMs);
+            m_lastFrame.gpuMs = stats->gpuTimerFreq > 0 ? float(double(stats->gpuTimeEnd - stats->gpuTimeBegin) * 1000.0 / double(stats->gpuTimerFreq)) : 0.f;
+            m_lastFrame.waitRenderMs = float(stats->waitRender * cpuToMs);
+            m_lastFrame.waitSubmitMs = float(stats->waitSubmit * cpuToMs);
+            m_lastFrame.numDraw = stats->numDraw;
+        }
+        m_frameHasRecords = false;
+        m_recordedRenderers.clear();
+    }
+};
+static bgfxRendererGlobal bgfxGlobal;
+
+
+/******************************************************************************/
+// ugly but it's to get bgfxGlobal access in cubes.h
+#include "cubes.h"
+
+/******************************************************************************/
+// Qt's threaded render loop renders each window on its own thread, with its own device
+// or context: only WorkerThread mode serves them all from a single bgfx context.
+// QSG_RENDER_LOOP is read when the first window is created.
+static void selectRenderLoop(ThreadingMode::Enum pThreadingMode)
+{
+    const QByteArray renderLoop = qgetenv("QSG_RENDER_LOOP");
+    if (pThreadingMode == ThreadingMode::WorkerThread || renderLoop == "basic")
+        return;
+    if (!renderLoop.isEmpty())
+        qWarning("QSG_RENDER_LOOP=%s requires bgfx WorkerThread mode, fallback to the basic render loop", renderLoop.constData());
+    qputenv("QSG_RENDER_LOOP", "basic");
+}
+
+/******************************************************************************/
+// Initialize BGFX
+bool InitQt_BGFX_Backend(QSGRendererInterface::GraphicsApi pBackend, InteropMode::Enum pInteropMode, ThreadingMode::Enum pThreadingMode, int pMaxInstancedGrid)
+{
+    //QRhiD3D11InitParams params;
+    //params.enableDebugLayer = true;
+    //rhi = QRhi::create(QRhi::D3D11, &params);
+
+    assert(bgfxGlobal.m_initialized == false);
+    bgfxGlobal.m_maxInstancedGrid = uint32_t(std::max(pMaxInstancedGrid, 0));
+    if (pBackend == QSGRendererInterface::Software)
+    {
+        // No GPU: Qt software scene graph and bgfx Noop renderer, there is nothing to
+        // composite so only the offscreen recording path makes sense.
+        QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+        if (pInteropMode != InteropMode::OffscreenFramebuffer)
+            qWarning("bgfx Noop renderer only supports InteropMode::OffscreenFramebuffer");
+        bgfxGlobal.m_interopMode = InteropMode::OffscreenFramebuffer;
+        bgfxGlobal.m_threadingMode = pThreadingMode;
+        bgfxGlobal.m_backend = bgfx::RendererType::Noop;
+        selectRenderLoop(pThreadingMode);
+        if (pThreadingMode == ThreadingMode::WorkerThread)
+            bgfxGlobal.startWorker();
+        return true;
+    }
+
+#ifndef _WIN32
+    if (pBackend == QSGRendererInterface::Direct3D11Rhi)
+    {
+        qWarning("Direct3D11 is only available on Windows, fallback to OpenGL");
+        pBackend = QSGRendererInterface::OpenGLRhi;
+    }
+#endif
+    QSGRendererInterface::GraphicsApi lBackend = pBackend == QSGRendererInterface::Direct3D11Rhi ? QSGRendererInterface::Direct3D11Rhi : QSGRendererInterface::OpenGLRhi;    
+    QQuickWindow::setSceneGraphBackend(lBackend);
+    bgfxGlobal.m_interopMode = pInteropMode;
+    bgfxGlobal.m_threadingMode = pThreadingMode;
+    bgfxGlobal.m_backend = lBackend == QSGRendererInterface::Direct3D11Rhi ? bgfx::RendererType::Direct3D11 : bgfx::RendererType::OpenGL;
+    if (pThreadingMode == ThreadingMode::WorkerThread && bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
+    {
+        // Each render thread has its own D3D11 device, bgfx textures can't be shared with them
+        qWarning("bgfx WorkerThread mode requires OpenGL, fallback to MultiThread");
+        bgfxGlobal.m_threadingMode = ThreadingMode::MultiThread;
+    }
+    if (bgfxGlobal.m_threadingMode != ThreadingMode::SingleThread && !bgfxGlobal.rendersOffscreen())
+    {
+        // Other modes render straight into Qt's current render target, they can't be deferred
+        qWarning("bgfx MultiThread/WorkerThread modes require an offscreen InteropMode, fallback to SingleThread");
+        bgfxGlobal.m_threadingMode = ThreadingMode::SingleThread;
+    }
+    selectRenderLoop(bgfxGlobal.m_threadingMode);
+    if (bgfxGlobal.m_threadingMode == ThreadingMode::WorkerThread)
+        bgfxGlobal.startWorker();
+    return true;
+}
+
+/******************************************************************************/
+void FinalizeQt_BGFX_Backend()
+{
+    bgfxGlobal.shutdown();
+}
+
+/******************************************************************************/
+uint64_t BgfxAllocationCount()
+{
+    return bgfxGlobal.m_allocator.m_count;
+}
+
+/******************************************************************************/
+class bgfxRenderer : public QObject
+{
+    Q_OBJECT
+public:
+    bgfxRenderer();
+    ~bgfxRenderer();
+
+    void setViewportSize(const QSize &size)
+    {
+        if
+            (m_viewportSize != size)
+        {
+            m_viewportSize = size;
+            m_dirty = true;
+
+            if (m_initialized)
+            {
+                resize();
+            }
+        }
+    }
+    // Shrink an oversized offscreen target once the size settled. Called from BgfxItem::sync(),
+    // before updatePaintNode() wraps the target: Qt never samples a destroyed texture
+    void shrinkTargets()
+    {
+        if (!m_initialized || !m_oversizedTimer.isValid() || !m_oversizedTimer.hasExpired(ShrinkDelayMs))
+            return;
+        bgfxGlobal.call([this] { resizeOffscreenFB(true); });
+        m_dirty = true; // the new target is empty
+    }
+    void setWindow(QQuickWindow *window) { m_window = window; }
+    void setGridSize(int pGridSize) { m_scene.gridSize = uint32_t(pGridSize); }
+    void setInstanced(bool pInstanced) { m_scene.instanced = pInstanced; }
+    void setOcclusionCulling(bool pOcclusionCulling) { m_scene.occlusionCulling = pOcclusionCulling; }
+    void setRenderPolicy(BgfxItem::RenderPolicy pRenderPolicy) { m_renderPolicy = pRenderPolicy; }
+    void setFramePacing(BgfxItem::FramePacing pFramePacing)
+    {
+        if (m_framePacing == pFramePacing)
+            return;
+        m_framePacing = pFramePacing;
+        m_dirty = true;
+
+        const int ringSize = targetRingSize(pFramePacing);
+        if (!m_initialized)
+            m_targetRingSize = ringSize;
+        else if (bgfxGlobal.rendersOffscreen())
+            bgfxGlobal.call([this, ringSize] { m_targetRingSize = ringSize; resizeOffscreenFB(); });
+    }
+    void setRenderTarget(int pSamples, BgfxItem::ColorFormat pColor, BgfxItem::DepthFormat pDepth, bool pDepthWriteOnly)
+    {
+        RenderTargetConfig config;
+        config.samples = uint32_t(pSamples);
+        config.color = pColor == BgfxItem::RGB10A2 ? bgfx::TextureFormat::RGB10A2
+            : pColor == BgfxItem::RGBA16F ? bgfx::TextureFormat::RGBA16F : bgfx::TextureFormat::RGBA8;
+        config.depth = pDepth == BgfxItem::D16 ? bgfx::TextureFormat::D16
+            : pDepth == BgfxItem::D32F ? bgfx::TextureFormat::D32F : bgfx::TextureFormat::D24S8;
+        config.depthWriteOnly = pDepthWriteOnly;
+        if (m_targetConfig == config)
+            return;
+        m_dirty = true;
+
+        if (!m_initialized)
+            m_targetConfig = config;
+        else if (bgfxGlobal.rendersOffscreen())
+        {
+            bgfxGlobal.call([this, config]
+            {
+                m_targetConfig = config;
+                {
+                    QMutexLocker lock(&m_targetsMutex);
+                    releaseTargets();
+                }
+                resizeOffscreenFB();
+            });
+        }
+    }
+    void setBackground(const QString& pPath)
+    {
+        if (m_scene.background != pPath)
+        {
+            m_scene.background = pPath;
+            m_loading = true; // until the API thread starts the load
+        }
+    }
+    void invalidate() { m_dirty = true; }
+    void setStatsFile(const QString& pStatsFile) { m_statsFile = pStatsFile; }
+    void setCaptureSink(const std::shared_ptr<BgfxCaptureSink>& pSink) { m_scene.captureSink = pSink; }
+    void setDynamicResolution(float pTargetFrameMs, float pMinScale, float pMaxScale)
+    {
+        m_scene.targetFrameMs = pTargetFrameMs;
+        m_scene.minScale = std::min(pMinScale, pMaxScale);
+        m_scene.maxScale = pMaxScale;
+    }
+    // Scale of the next recording, Qt's render thread
+    float renderScale() const { return effectiveScale(m_scene); }
+    BgfxFrameStats stats() const;
+
+    // Content is still loading, or was loaded and not rendered yet
+    bool isLoading() const { return !viewsExhausted() && (m_loading || m_contentChanged); }
+
+    // A recording is still queued on the API thread or waits for the other items of its
+    // tick, a rendered frame isn't composited yet, waiting for the GPU (FramePacing::Throughput),
+    // or a capture isn't read back yet
+    bool hasFrameInFlight() const;
+
+    // No view range was left for this renderer at init: it records nothing
+    bool viewsExhausted() const { return m_initialized && m_viewId == bgfxRendererGlobal::InvalidView; }
+
+    // Native offscreen color texture (ID3D11Texture2D* or GL texture id), 0 if not created yet.
+    // Render thread only.
+    uintptr_t compositeTexture() const;
+    QSize compositeSize() const { return m_offscreenSize; }
+    uint32_t compositeGeneration() const { return m_targetsGeneration; }
+    QRect compositeRect() const { return offscreenRect(); }
+
+public slots:
+    void frameStart();
+    void mainPassRecordingStart();
+
+private:
+    InteropMode::Enum m_interopMode = InteropMode::OffscreenFramebuffer;
+
+    // Scene state given by the item in sync(), copied into each recording so the
+    // API thread never reads it while Qt's render thread updates it.
+    struct SceneParams
+    {
+        QSize viewportSize;
+        uint32_t gridSize = 11;
+        bool instanced = false;
+        bool occlusionCulling = false;
+        QString background;     // image file, empty for none
+        std::shared_ptr<BgfxCaptureSink> captureSink;
+        float targetFrameMs = 0.f;  // dynamic resolution, 0 for none
+        float minScale = 0.5f;
+        float maxScale = 1.f;
+    };
+
+    void resize();
+    void resize_Backend();
+    void render_Common(); // render bgfx stuff
+    void record(const SceneParams& pScene); // record bgfx views, on the bgfx API thread
+    void skipRecord();                      // keep the last frame, on the bgfx API thread
+    void loadBackground(const QString& pPath); // on the bgfx API thread
+
+#ifdef _WIN32
+    void render_ExternPlatform_DX11();             // Use platformData to set backBuffer
+    void render_SynchroFramebuffer_DX11();         // Create a bgfx::Framebuffer synchronized with extern Texture handle given by Qt
+    void render_OffscreenFramebuffer_DX11();       // Create a bgfx::Framebuffer, render to it, then blit result
+
+    void resize_ExternPlatform_DX11();
+    void resize_SynchroFramebuffer_DX11();
+    void resize_OffscreenFramebuffer_DX11();
+#endif
+
+
+    void render_ExternPlatform_GL();             // Use platformData to set backBuffer
+    void render_SynchroFramebuffer_GL();         // Create a bgfx::Framebuffer synchronized with extern Texture handle given by Qt
+    void render_OffscreenFramebuffer_GL();       // Create a bgfx::Framebuffer, render to it, then blit result
+
+    void render_TextureNode();                   // Create a bgfx::Framebuffer (or atlas region), render to it, then let the scene graph sample it
+    void render_Noop();                          // bgfx Noop renderer, record and submit only
+
+    void resize_ExternPlatform_GL();
+    void resize_SynchroFramebuffer_GL();
+    void resize_OffscreenFramebuffer_GL();
+
+
+    void init();
+    QSize m_viewportSize;
+    SceneParams m_scene;
+    BgfxItem::RenderPolicy m_renderPolicy = BgfxItem::Continuous;
+    BgfxItem::FramePacing m_framePacing = BgfxItem::LowLatency;
+    bool m_dirty = true;
+
+    // --- Asynchronous loads, requested and completed on the API thread
+    QString m_backgroundPath;
+    bgfxResourceLoader::Ticket m_backgroundTicket = bgfxResourceLoader::InvalidTicket;
+    TextureStream* m_backgroundStream = nullptr;        // shared by content, see bgfxRendererGlobal::acquireStream()
+    QSize m_recordedSize;                               // viewport of the last recording
+    void releaseBackground();
+    std::atomic<bool> m_loading{ false };
+    std::atomic<bool> m_contentChanged{ false }; // a load completed, record a new frame
+    std::atomic<int> m_pendingRecords{ 0 };     // posted to the API thread, not recorded yet
+    std::atomic<uint32_t> m_recordedFrame{ 0 }; // bgfxGlobal.m_submittedFrames of the last recording
+
+    // --- Frame timings, written by the thread recording (API thread), read in sync()
+    mutable QMutex m_statsMutex;
+    FrameStatsHistory m_statsHistory;
+    // Percentiles of the history, recomputed at most every StatsPercentilesPeriodMs by stats()
+    static const int StatsPercentilesPeriodMs = 500;
+    mutable BgfxFrameStats m_statsPercentiles;
+    mutable int64_t m_statsPercentilesTime = 0;
+    QString m_statsFile;
+    QQuickWindow *m_window;
+
+#ifdef _WIN32
+    // D3d device
+    ID3D11Device *m_device = nullptr;
+    ID3D11DeviceContext *m_context = nullptr;
+#endif
+
+    // GL
+    QOpenGLContext* m_glcontext = nullptr;
+    void* m_nativeglcontext = nullptr;
+    void* m_nativedisplay = nullptr;   // X11 display with GLX, bgfx::PlatformData::ndt
+
+    ExampleCubes bgfxExample;
+    bool m_initialized = false;
+    bool m_needreset = true;
+
+    // --- Offscreen framebuffer allocation
+    // Render targets are allocated in SizeBucket steps and rendered into a sub-rect
+    // (setViewRect), so a window drag only reallocates when crossing a bucket.
+    // Shrinking is deferred until the target stayed oversized for ShrinkDelayMs.
+    static const int SizeBucket = 256;
+    static const qint64 ShrinkDelayMs = 2000;
+    static QSize bucketSize(const QSize& pSize);
+    void resizeOffscreenFB(bool pShrink = false);
+    QRect offscreenRect() const; // rendered sub-rect of the composited target, in texture memory coordinates
+    QRect targetRect(const QSize& pSize) const; // same for a viewport of pSize
+    void releaseTargets();
+    QSize m_offscreenSize;
+    QPoint m_targetOrigin;      // of the rendered sub-rect in bgfx view coordinates, set for an atlas region
+    QElapsedTimer m_oversizedTimer;
+
+    // --- Texture atlas region (InteropMode::TextureAtlas)
+    // The targets are the pages of bgfxGlobal's atlas, rendered at the region origin.
+    // Regions are padded by AtlasGutter pixels so filtering never reads a neighbour,
+    // and rounded to AtlasGranularity so small resizes keep the region. An item too
+    // large for the atlas gets targets of its own, as in TextureNode.
+    static const int AtlasGranularity = 32;
+    static const int AtlasGutter = 2;
+    int m_atlasRegion = -1;
+    bool resizeAtlasRegion();   // false if the viewport doesn't fit in the atlas
+    void attachAtlasRegion();
+
+    // --- Offscreen targets ring
+    // LowLatency renders into a single target, composited right after it's rendered.
+    // Throughput rotates through MaxTargets targets: each recording renders into one
+    // that isn't displayed, a fence is inserted on Qt's render thread once bgfx executed
+    // that frame, and Qt composites the newest target whose fence signaled. Composition
+    // doesn't wait for the frame the GPU is rendering, at the cost of a frame of latency.
+    // The depth buffer is shared, targets are rendered in order on the same device.
+    // WorkerThread mode renders while the windows composite, never into the displayed target:
+    // always a ring, frames are published once the worker's fence of the frame signaled.
+    static const int MaxTargets = 3;
+    static int targetRingSize(BgfxItem::FramePacing pFramePacing)
+    {
+        return pFramePacing == BgfxItem::Throughput || bgfxGlobal.m_threadingMode == ThreadingMode::WorkerThread ? MaxTargets : 1;
+    }
+    struct OffscreenTarget
+    {
+        enum State { Free, Recorded, Submitted, Displayed };
+        bgfx::FrameBufferHandle fb = BGFX_INVALID_HANDLE;
+        bgfx::TextureHandle color = BGFX_INVALID_HANDLE;
+        State state = Free;
+        uint32_t frame = 0;             // bgfxGlobal.m_submittedFrames of the frame rendering into it
+        QSize size;                     // viewport rendered
+#ifdef _WIN32
+        ID3D11Query* query = nullptr;   // D3D11 event query, render thread
+#endif
+        GLsync sync = nullptr;          // GL fence, render thread
+    };
+    OffscreenTarget m_targets[MaxTargets];
+    bgfx::TextureHandle m_targetsDepth = BGFX_INVALID_HANDLE;
+    int m_targetRingSize = 1;           // MaxTargets for FramePacing::Throughput, API thread
+    RenderTargetConfig m_targetConfig;  // requested, API thread once initialized
+    RenderTargetConfig m_activeConfig;  // of the targets, with the fallbacks
+    int m_targetCount = 0;              // allocated
+    int m_displayedTarget = -1;         // composited, -1 for none
+    std::atomic<uint32_t> m_targetsGeneration{ 1 }; // incremented when the targets are recreated
+    mutable QMutex m_targetsMutex;      // target states, recorded on the API thread and composited on Qt's render thread
+    int acquireTarget(const QSize& pSize);          // target to record into, API thread
+    void updateTargets();                           // fences and displayed target, Qt's render thread
+    void insertFence(OffscreenTarget& pTarget);
+    bool isFenceSignaled(OffscreenTarget& pTarget);
+    void releaseFences();
+    bgfx::TextureHandle displayedColor() const;
+
+    // --- Dynamic resolution
+    // The pixel count is about proportional to the GPU time: the scale follows
+    // sqrt(target / measured). Over budget it drops at once so a load spike costs a
+    // single frame, under budget it climbs back in small steps on a smoothed time.
+    // A sample measures a frame recorded one or two frames earlier: after a change,
+    // ScaleSettleFrames samples are skipped. The viewport is rendered in a sub-rect of
+    // the target, upscaled when composited.
+    static const int ScaleSettleFrames = 3;
+    static constexpr float ScaleStep = 1.f / 64.f;  // fewer distinct sizes
+    std::atomic<float> m_renderScale{ 1.f };       // API thread, read in render_Common()
+    float m_smoothedGpuMs = 0.f;
+    uint32_t m_scaleFrame = 0;                      // bgfx frame of the last sample
+    int m_scaleSettle = 0;
+    bool canScale() const;
+    float effectiveScale(const SceneParams& pScene) const;
+    void updateRenderScale(const FrameSample& pSample, const SceneParams& pScene); // API thread
+
+    // --- Capture
+    // Each recorded frame is blitted into a read back texture after the item views, then
+    // bgfx::readTexture() copies it to a pooled buffer a few frames later. Completed
+    // buffers are given to the sink on m_captureThread, in order. A frame is dropped when
+    // every slot is busy, recording never waits for a readback.
+    static const int CaptureSlots = 4;
+    struct CaptureSlot
+    {
+        enum State { Free, Reading, Delivering };
+        bgfx::TextureHandle texture = BGFX_INVALID_HANDLE;  // BLIT_DST | READ_BACK, API thread
+        QSize textureSize;
+        std::vector<uint8_t> buffer;                        // RGBA8, textureSize
+        std::shared_ptr<BgfxCaptureSink> sink;
+        uint32_t frame = 0;                                 // OffscreenTarget::frame
+        uint32_t readyFrame = 0;                            // bgfx::frame() number the buffer is written at
+        std::atomic<int> state{ Free };
+    };
+    CaptureSlot m_captureSlots[CaptureSlots];
+    QThreadPool m_captureThread;    // single thread, frames are delivered in order
+    bool m_captureWarned = false;
+    void capture(int pTarget, const std::shared_ptr<BgfxCaptureSink>& pSink);  // API thread
+    void pollCaptures();                                                        // API thread
+    bool hasPendingReadback() const;
+    void releaseCaptures();
+
+    // --- Views owned by this renderer, given by bgfxGlobal.allocViews()
+    // The example views, then the capture blit view
+    static const uint16_t ViewCount = ExampleCubes::ViewCount + 1;
+    bgfx::ViewId captureView() const { return bgfx::ViewId(m_viewId + ExampleCubes::ViewCount); }
+    bgfx::ViewId m_viewId = bgfxRendererGlobal::InvalidView;
+
+    // --- Synchronized Framebuffer
+    bgfx::FrameBufferHandle offscreenFB = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle backBuffer = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle depthBuffer = BGFX_INVALID_HANDLE;
+    uintptr_t backBufferNative = 0;
+    uintptr_t depthBufferNative = 0;
+    // --- 
+
+    // --- GL blit framebuffer (OffscreenFramebuffer), bound to m_blitFBTexture
+    GLuint m_blitFB = 0;
+    uintptr_t m_blitFBTexture = 0;
+    // ---
+};
+
+/******************************************************************************/
+// Scene graph node sampling the offscreen color texture of a bgfxRenderer (InteropMode::TextureNode/TextureAtlas)
+class BgfxTextureNode : public QSGSimpleTextureNode
+{
+public:
+    ~BgfxTextureNode() override { clear(); }
+
+    // Wrap the native texture in a QSGTexture, only once per target of the renderer ring.
+    // pGeneration changes when the targets are recreated (native handles may be reused).
+    void setNativeTexture(QQuickWindow* pWindow, uintptr_t pNative, const QSize& pSize, uint32_t pGeneration)
+    {
+        if (pGeneration != m_generation)
+        {
+            clear();
+            m_generation = pGeneration;
+        }
+
+        auto cached = std::find_if(m_textures.begin(), m_textures.end(),
+            [pNative](const std::pair<uintptr_t, QSGTexture*>& pTexture) { return pTexture.first == pNative; });
+        if (cached != m_textures.end())
+        {
+            setTexture(cached->second);
+            return;
+        }
+
+        QSGTexture* texture = nullptr;
+#ifdef _WIN32
+        if (bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
+        {
+            ID3D11Texture2D* d3dTexture = reinterpret_cast<ID3D11Texture2D*>(pNative);
+            texture = pWindow->createTextureFromNativeObject(QQuickWindow::NativeObjectTexture, &d3dTexture, 0, pSize);
+        }
+        else
+#endif
+        {
+            uint glTexture = uint(pNative);
+            texture = pWindow->createTextureFromNativeObject(QQuickWindow::NativeObjectTexture, &glTexture, 0, pSize);
+            // bgfx GL render targets have their origin at the bottom left
+            setTextureCoordinatesTransform(QSGSimpleTextureNode::MirrorVertically);
+        }
+
+        m_textures.emplace_back(pNative, texture);
+        setTexture(texture);
+    }
+
+private:
+    void clear()
+    {
+        setTexture(nullptr);
+        for (const std::pair<uintptr_t, QSGTexture*>& texture : m_textures)
+            delete texture.second;
+        m_textures.clear();
+    }
+
+    std::vector<std::pair<uintptr_t, QSGTexture*>> m_textures; // by native texture
+    uint32_t m_generation = 0;
+};
+
+/******************************************************************************/
+BgfxItem::BgfxItem()
+: mRenderer(nullptr)
+{
+    connect(this, &QQuickItem::windowChanged, this, &BgfxItem::handleWindowChanged);
+    connect(&mFixedRateTimer, &QTimer::timeout, this, &BgfxItem::invalidate);
+    if (bgfxGlobal.samplesOffscreen())
+        setFlag(ItemHasContents, true);
+}
+
+/******************************************************************************/
+QSGNode* BgfxItem::updatePaintNode(QSGNode* node, UpdatePaintNodeData* data)
+{
+    if (mRenderPolicy == Continuous)
+        update(); // render every frame
+    if (!bgfxGlobal.samplesOffscreen())
+        return QQuickItem::updatePaintNode(node, data);
+
+    // Zero-copy composition: the scene graph samples the bgfx offscreen color texture.
+    // Drop the node while the texture is (re)created, bgfx creates it on next frame.
+    uintptr_t native = mRenderer ? mRenderer->compositeTexture() : 0;
+    if (mRenderer && mRenderer->viewsExhausted())
+    {
+        delete node;
+        return nullptr;
+    }
+    if (native == 0)
+    {
+        mDirty = true; // GUI thread is blocked during updatePaintNode
+        update();
+        delete node;
+        return nullptr;
+    }
+
+    BgfxTextureNode* textureNode = static_cast<BgfxTextureNode*>(node);
+    if (!textureNode)
+        textureNode = new BgfxTextureNode;
+    textureNode->setNativeTexture(window(), native, mRenderer->compositeSize(), mRenderer->compositeGeneration());
+    // bgfx renders the whole window like the other interop modes, or the item in its atlas region
+    if (bgfxGlobal.m_interopMode == InteropMode::TextureAtlas)
+        textureNode->setRect(boundingRect());
+    else
+        textureNode->setRect(QRectF(mapFromScene(QPointF(0, 0)), QSizeF(window()->size())));
+    // Upscaled when rendered at a lower resolution (dynamic resolution). Linear filtering
+    // would blend the edge texels with the stale ones around the rendered rect: sample
+    // from half a texel inside it.
+    QRectF source = mRenderer->compositeRect();
+    const QSize pixels = (textureNode->rect().size() * window()->devicePixelRatio()).toSize();
+    const bool scaled = source.size().toSize() != pixels;
+    if (scaled)
+        source.adjust(0.5, 0.5, -0.5, -0.5);
+    textureNode->setSourceRect(source);
+    textureNode->setFiltering(scaled ? QSGTexture::Linear : QSGTexture::Nearest);
+    return textureNode;
+}
+
+/******************************************************************************/
+void BgfxItem::setGridSize(int pGridSize)
+{
+    if (mGridSize == pGridSize)
+        return;
+    mGridSize = pGridSize;
+    emit gridSizeChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setInstanced(bool pInstanced)
+{
+    if (mInstanced == pInstanced)
+        return;
+    mInstanced = pInstanced;
+    emit instancedChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setOcclusionCulling(bool pOcclusionCulling)
+{
+    if (mOcclusionCulling == pOcclusionCulling)
+        return;
+    mOcclusionCulling = pOcclusionCulling;
+    emit occlusionCullingChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setRenderPolicy(RenderPolicy pRenderPolicy)
+{
+    if (mRenderPolicy == pRenderPolicy)
+        return;
+    mRenderPolicy = pRenderPolicy;
+    updateFixedRateTimer();
+    emit renderPolicyChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setFixedRate(int pFixedRate)
+{
+    if (mFixedRate == pFixedRate)
+        return;
+    mFixedRate = pFixedRate;
+    updateFixedRateTimer();
+    emit fixedRateChanged();
+}
+
+/******************************************************************************/
+void BgfxItem::setFramePacing(FramePacing pFramePacing)
+{
+    if (mFramePacing == pFramePacing)
+        return;
+    mFramePacing = pFramePacing;
+    emit framePacingChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setSamples(int pSamples)
+{
+    // Power of two in [1, 16]
+    int samples = 1;
+    while (samples < 16 && samples * 2 <= pSamples)
+        samples *= 2;
+    if (mSamples == samples)
+        return;
+    mSamples = samples;
+    emit samplesChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setColorFormat(ColorFormat pColorFormat)
+{
+    if (mColorFormat == pColorFormat)
+        return;
+    mColorFormat = pColorFormat;
+    emit colorFormatChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setDepthFormat(DepthFormat pDepthFormat)
+{
+    if (mDepthFormat == pDepthFormat)
+        return;
+    mDepthFormat = pDepthFormat;
+    emit depthFormatChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setDepthWriteOnly(bool pDepthWriteOnly)
+{
+    if (mDepthWriteOnly == pDepthWriteOnly)
+        return;
+    mDepthWriteOnly = pDepthWriteOnly;
+    emit depthWriteOnlyChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setTargetFrameTime(float pTargetFrameTime)
+{
+    pTargetFrameTime = std::max(pTargetFrameTime, 0.f);
+    if (mTargetFrameTime == pTargetFrameTime)
+        return;
+    mTargetFrameTime = pTargetFrameTime;
+    emit targetFrameTimeChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setMinRenderScale(float pMinRenderScale)
+{
+    pMinRenderScale = std::max(std::min(pMinRenderScale, 1.f), 0.25f);
+    if (mMinRenderScale == pMinRenderScale)
+        return;
+    mMinRenderScale = pMinRenderScale;
+    emit minRenderScaleChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setMaxRenderScale(float pMaxRenderScale)
+{
+    pMaxRenderScale = std::max(std::min(pMaxRenderScale, 1.f), 0.25f);
+    if (mMaxRenderScale == pMaxRenderScale)
+        return;
+    mMaxRenderScale = pMaxRenderScale;
+    emit maxRenderScaleChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setBackground(const QUrl& pBackground)
+{
+    if (mBackground == pBackground)
+        return;
+    mBackground = pBackground;
+    // QFile path: resources are ":/path", QML resolves them as "qrc:/path"
+    if (pBackground.scheme() == QLatin1String("qrc"))
+        mBackgroundPath = ':' + pBackground.path();
+    else if (pBackground.isLocalFile())
+        mBackgroundPath = pBackground.toLocalFile();
+    else
+        mBackgroundPath = pBackground.toString();
+    emit backgroundChanged();
+    invalidate();
+}
+
+/******************************************************************************/
+void BgfxItem::setStatsFile(const QString& pStatsFile)
+{
+    if (mStatsFile == pStatsFile)
+        return;
+    mStatsFile = pStatsFile;
+    emit statsFileChanged();
+}
+
+/******************************************************************************/
+void BgfxItem::setCaptureSink(std::shared_ptr<BgfxCaptureSink> pSink)
+{
+    if (mCaptureSink == pSink)
+        return;
+    mCaptureSink = std::move(pSink);
+    invalidate(); // capture the current content too
+}
+
+/******************************************************************************/
+void BgfxItem::setCaptureFile(const QString& pCaptureFile)
+{
+    if (mCaptureFile == pCaptureFile)
+        return;
+    mCaptureFile = pCaptureFile;
+    const int frameRate = mRenderPolicy == FixedRate && mFixedRate > 0 ? mFixedRate : 60;
+    setCaptureSink(pCaptureFile.isEmpty() ? nullptr : std::make_shared<Y4MCaptureSink>(pCaptureFile, frameRate));
+    emit captureFileChanged();
+}
+
+/******************************************************************************/
+void BgfxItem::updateFixedRateTimer()
+{
+    if (mRenderPolicy == FixedRate && mFixedRate > 0)
+        mFixedRateTimer.start(1000 / mFixedRate);
+    else
+        mFixedRateTimer.stop();
+}
+
+/******************************************************************************/
+void BgfxItem::invalidate()
+{
+    mDirty = true;
+    update();
+    if (window())
+        window()->update();
+}
+
+/******************************************************************************/
+void BgfxItem::handleWindowChanged(QQuickWindow *win)
+{
+    if (win) {
+        connect(win, &QQuickWindow::beforeSynchronizing, this, &BgfxItem::sync, Qt::DirectConnection);
+        connect(win, &QQuickWindow::sceneGraphInvalidated, this, &BgfxItem::cleanup, Qt::DirectConnection);
+
+        // Ensure we start with cleared to black. The squircle's blend mode relies on this.
+        win->setColor(Qt::black);
+    }
+}
+
+/******************************************************************************/
+bgfxRenderer::bgfxRenderer()
+{
+    m_captureThread.setMaxThreadCount(1);
+}
+
+/******************************************************************************/
+// The safe way to release custom graphics resources it to both connect to
+// sceneGraphInvalidated() and implement releaseResources(). To support
+// threaded render loops the latter performs the bgfxRenderer destruction
+// via scheduleRenderJob(). Note that the bgfxItem may be gone by the time
+// the QRunnable is invoked, and that the job never runs if the window is
+// destroyed before its next frame.
+void BgfxItem::cleanup()
+{
+    delete mRenderer;
+    mRenderer = nullptr;
+}
+
+/******************************************************************************/
+class CleanupJob : public QRunnable
+{
+public:
+    CleanupJob(bgfxRenderer* pRenderer) : mRenderer(pRenderer) { }
+    // ~QQuickWindow deletes the jobs still pending, on the GUI thread once the render
+    // thread is gone: the renderer is released there instead
+    ~CleanupJob() override { delete mRenderer; }
+    void run() override { delete mRenderer; mRenderer = nullptr; }
+private:
+    bgfxRenderer * mRenderer;
+};
+
+/******************************************************************************/
+void BgfxItem::releaseResources()
+{
+    window()->scheduleRenderJob(new CleanupJob(mRenderer), QQuickWindow::BeforeSynchronizingStage);
+    mRenderer = nullptr;
+}
+
+/******************************************************************************/
+bgfxRenderer::~bgfxRenderer()
+{
+    qDebug("cleanup");
+    if (m_blitFB != 0 && QOpenGLContext::currentContext() == m_glcontext)
+    {
+        m_glcontext->functions()->glDeleteFramebuffers(1, &m_blitFB);
+        m_blitFB = 0;
+    }
+    releaseFences();
+    // Also waits for the recordings still queued on the API thread
+    bgfxGlobal.call([this]
+    {
+        bgfxGlobal.unregisterRenderer(this);
+        releaseCaptures();
+        if (m_atlasRegion >= 0)
+        {
+            bgfxGlobal.freeAtlasRegion(m_atlasRegion);
+            bgfxGlobal.trimAtlas();
+        }
+        if (bgfxGlobal.m_initialized)
+            releaseBackground();
+        else
+            m_backgroundStream = nullptr; // bgfx is shut down, its textures are gone
+        // Releases this item's references on the shared resources
+        if (m_initialized && bgfxGlobal.m_initialized && !viewsExhausted())
+            bgfxExample.shutdown();
+        bgfxGlobal.freeViews(m_viewId, ViewCount);
+        m_viewId = bgfxRendererGlobal::InvalidView;
+    });
+
+    if (!m_statsFile.isEmpty())
+    {
+        QMutexLocker lock(&m_statsMutex);
+        if (!m_statsHistory.write(m_statsFile))
+            qWarning("Can't write bgfx frame stats to %s", qPrintable(m_statsFile));
+    }
+    /* crash
+    bgfxExample.shutdown();
+
+    if (bgfx::isValid(backBuffer))
+        bgfx::destroy(backBuffer);
+
+    if (bgfx::isValid(depthBuffer))
+        bgfx::destroy(depthBuffer);
+
+    if (bgfx::isValid(offscreenFB))
+        bgfx::destroy(offscreenFB);
+
+    bgfx::frame();
+    */
+}
+
+/******************************************************************************/
+void BgfxItem::sync()
+{
+    if (!mRenderer) {
+        mRenderer = new bgfxRenderer;
+        connect(window(), &QQuickWindow::beforeRendering, mRenderer, &bgfxRenderer::frameStart, Qt::DirectConnection);
+        connect(window(), &QQuickWindow::beforeRenderPassRecording, mRenderer, &bgfxRenderer::mainPassRecordingStart, Qt::DirectConnection);
+    }
+    // An atlas region only holds the item
+    const QSize size = bgfxGlobal.m_interopMode == InteropMode::TextureAtlas ? QSizeF(width(), height()).toSize() : window()->size();
+    mRenderer->setViewportSize((size * window()->devicePixelRatio()).expandedTo(QSize(1, 1)));
+    mRenderer->shrinkTargets();
+    mRenderer->setWindow(window());
+    mRenderer->setGridSize(mGridSize);
+    mRenderer->setInstanced(mInstanced);
+    mRenderer->setOcclusionCulling(mOcclusionCulling);
+    mRenderer->setRenderPolicy(mRenderPolicy);
+    mRenderer->setFramePacing(mFramePacing);
+    mRenderer->setRenderTarget(mSamples, mColorFormat, mDepthFormat, mDepthWriteOnly);
+    mRenderer->setBackground(mBackgroundPath);
+    mRenderer->setStatsFile(mStatsFile);
+    mRenderer->setCaptureSink(mCaptureSink);
+    mRenderer->setDynamicResolution(mTargetFrameTime, mMinRenderScale, mMaxRenderScale);
+    // sync() runs on the render thread with the GUI thread blocked: the copies are safe,
+    // the notifications are queued to the GUI thread where the bindings are evaluated
+    mStats = mRenderer->stats();
+    QMetaObject::invokeMethod(this, &BgfxItem::statsChanged, Qt::QueuedConnection);
+    if (mRenderScale != mRenderer->renderScale())
+    {
+        mRenderScale = mRenderer->renderScale();
+        QMetaObject::invokeMethod(this, &BgfxItem::renderScaleChanged, Qt::QueuedConnection);
+    }
+    if (mDirty)
+    {
+        mRenderer->invalidate();
+        mDirty = false;
+    }
+    // Keep the window updating until loads complete, they are polled once per bgfx frame
+    if (mRenderer->isLoading())
+        window()->update();
+    // Same until the last frame is composited, its fence is polled once per Qt frame
+    if (mRenderer->hasFrameInFlight())
+    {
+        update();
+        window()->update();
+    }
+}
+
+
+/******************************************************************************/
+QRect bgfxRenderer::offscreenRect() const
+{
+    // The composited frame may be rendered at another size (ring, dynamic resolution)
+    QSize size = m_viewportSize;
+    QMutexLocker lock(&m_targetsMutex);
+    if (m_displayedTarget >= 0 && m_targets[m_displayedTarget].size.isValid())
+        size = m_targets[m_displayedTarget].size;
+    return targetRect(size);
+}
+
+/******************************************************************************/
+QRect bgfxRenderer::targetRect(const QSize& pSize) const
+{
+    // bgfx view rects are top-left based, GL textures are stored bottom-up
+    if (bgfxGlobal.m_backend == bgfx::RendererType::OpenGL)
+        return QRect(m_targetOrigin.x(), m_offscreenSize.height() - m_targetOrigin.y() - pSize.height(), pSize.width(), pSize.height());
+    return QRect(m_targetOrigin, pSize);
+}
+
+/******************************************************************************/
+QSize bgfxRenderer::bucketSize(const QSize& pSize)
+{
+    return QSize(
+        std::max(1, (pSize.width() + SizeBucket - 1) / SizeBucket) * SizeBucket,
+        std::max(1, (pSize.height() + SizeBucket - 1) / SizeBucket) * SizeBucket);
+}
+
+/******************************************************************************/
+void bgfxRenderer::resizeOffscreenFB(bool pShrink)
+{
+    if (bgfxGlobal.m_interopMode == InteropMode::TextureAtlas && resizeAtlasRegion())
+        return;
+
+    const bool fits = m_viewportSize.width() <= m_offscreenSize.width() && m_viewportSize.height() <= m_offscreenSize.height();
+    const QSize bucket = bucketSize(m_viewportSize);
+    if (bgfx::isValid(m_targets[0].fb) && m_targetCount == m_targetRingSize && fits && !(pShrink && bucket != m_offscreenSize))
+    {
+        // Large enough: keep rendering into a sub-rect. An oversized target is only
+        // shrunk once it stayed oversized for ShrinkDelayMs (see frameStart)
+        if (bucket == m_offscreenSize)
+            m_oversizedTimer.invalidate();
+        else if (!m_oversizedTimer.isValid())
+            m_oversizedTimer.start();
+        return;
+    }
+    m_oversizedTimer.invalidate();
+
+    QMutexLocker lock(&m_targetsMutex);
+    releaseTargets();
+    m_targetOrigin = QPoint(0, 0);
+    m_offscreenSize = bucket;
+    m_targetCount = m_targetRingSize;
+    m_activeConfig = m_targetConfig.supported();
+    m_targetsDepth = bgfx::createTexture2D(m_offscreenSize.width(), m_offscreenSize.height(), false, 1, m_activeConfig.depth, m_activeConfig.depthFlags(), NULL);
+    for (int ii = 0; ii < m_targetCount; ++ii)
+    {
+        OffscreenTarget& target = m_targets[ii];
+        target.color = bgfx::createTexture2D(m_offscreenSize.width(), m_offscreenSize.height(), false, 1, m_activeConfig.color, m_activeConfig.colorFlags(), NULL);
+        bgfx::TextureHandle fbtextures[2] = { target.color, m_targetsDepth };
+        target.fb = bgfx::createFrameBuffer(BX_COUNTOF(fbtextures), fbtextures, false);
+    }
+    // A single target is always composited, a ring waits for its first completed frame
+    m_displayedTarget = m_targetCount == 1 ? 0 : -1;
+    ++m_targetsGeneration;
+
+    // Texture recreated (its GL id may be reused): reattach it on next blit
+    m_blitFBTexture = 0;
+}
+
+/******************************************************************************/
+// m_targetsMutex locked
+void bgfxRenderer::releaseTargets()
+{
+    const bool owned = m_atlasRegion < 0;
+    for (OffscreenTarget& target : m_targets)
+    {
+        if (owned && bgfx::isValid(target.fb))
+            bgfx::destroy(target.fb);
+        if (owned && bgfx::isValid(target.color))
+            bgfx::destroy(target.color);
+        target.fb = BGFX_INVALID_HANDLE;
+        target.color = BGFX_INVALID_HANDLE;
+        target.state = OffscreenTarget::Free;
+    }
+
+    if (bgfx::isValid(m_targetsDepth))
+    {
+        bgfx::destroy(m_targetsDepth);
+        m_targetsDepth = BGFX_INVALID_HANDLE;
+    }
+
+    if (!owned)
+    {
+        bgfxGlobal.freeAtlasRegion(m_atlasRegion);
+        m_atlasRegion = -1;
+    }
+    m_targetCount = 0;
+}
 
-    void resize_ExternPlatform_GL();
-    void resize_SynchroFramebuffer_GL();
-    void resize_OffscreenFramebuffer_GL();
+/******************************************************************************/
+bool bgfxRenderer::resizeAtlasRegion()
+{
+    const QSize size(
+        (m_viewportSize.width() + AtlasGutter + AtlasGranularity - 1) / AtlasGranularity * AtlasGranularity,
+        (m_viewportSize.height() + AtlasGutter + AtlasGranularity - 1) / AtlasGranularity * AtlasGranularity);
+    if (m_atlasRegion >= 0 && m_targetCount == m_targetRingSize && bgfxGlobal.atlasRect(m_atlasRegion).size() == size)
+        return true;
+    if (size.width() > bgfxGlobal.atlasMaxSize() || size.height() > bgfxGlobal.atlasMaxSize())
+        return false;
 
+    {
+        QMutexLocker lock(&m_targetsMutex);
+        releaseTargets();
+    }
+    // May move the other regions, and call their attachAtlasRegion()
+    m_atlasRegion = bgfxGlobal.allocAtlasRegion(size, m_targetRingSize, m_targetConfig.supported(), [this] { attachAtlasRegion(); });
+    if (m_atlasRegion < 0)
+        return false;
+    attachAtlasRegion();
+    return true;
+}
 
-    void init();
-    QSize m_viewportSize;
-    QQuickWindow *m_window;
+/******************************************************************************/
+// API thread, when the region is allocated or moved to new pages
+void bgfxRenderer::attachAtlasRegion()
+{
+    QMutexLocker lock(&m_targetsMutex);
+    m_offscreenSize = bgfxGlobal.atlasSize();
+    m_activeConfig = bgfxGlobal.m_atlasConfig;
+    m_targetOrigin = bgfxGlobal.atlasRect(m_atlasRegion).topLeft();
+    m_targetCount = m_targetRingSize;
+    for (int ii = 0; ii < m_targetCount; ++ii)
+    {
+        OffscreenTarget& target = m_targets[ii];
+        target.fb = bgfxGlobal.atlasPage(ii).fb;
+        target.color = bgfxGlobal.atlasPage(ii).color;
+        target.state = OffscreenTarget::Free;
+    }
+    m_displayedTarget = m_targetCount == 1 ? 0 : -1;
+    ++m_targetsGeneration;
+    m_blitFBTexture = 0;
+    m_contentChanged = true; // a moved region lost its content
+}
 
-    // D3d device
-    ID3D11Device *m_device = nullptr;
-    ID3D11DeviceContext *m_context = nullptr;
+/******************************************************************************/
+int bgfxRenderer::acquireTarget(const QSize& pSize)
+{
+    QMutexLocker lock(&m_targetsMutex);
+    int index = 0;
+    if (m_targetCount > 1)
+    {
+        // A free target, else the oldest frame still in flight: it won't be composited,
+        // the newer frame replaces it instead of waiting for the GPU
+        index = -1;
+        for (int ii = 0; ii < m_targetCount; ++ii)
+        {
+            const OffscreenTarget& target = m_targets[ii];
+            if (target.state == OffscreenTarget::Displayed)
+                continue;
+            if (target.state == OffscreenTarget::Free)
+            {
+                index = ii;
+                break;
+            }
+            if (index < 0 || target.frame < m_targets[index].frame)
+                index = ii;
+        }
+        assert(index >= 0);
+    }
 
-    // GL
-    QOpenGLContext* m_glcontext = nullptr;
-    void* m_nativeglcontext = nullptr;
+    OffscreenTarget& target = m_targets[index];
+    if (m_targetCount > 1)
+        target.state = OffscreenTarget::Recorded;
+    target.frame = bgfxGlobal.m_submittedFrames + 1; // recorded into the next bgfx::frame()
+    target.size = pSize;
+    return index;
+}
 
-    ExampleCubes bgfxExample;
-    bool m_initialized = false;
-    bool m_needreset = true;
+/******************************************************************************/
+void bgfxRenderer::updateTargets()
+{
+    QMutexLocker lock(&m_targetsMutex);
+    if (m_targetCount <= 1)
+        return;
 
-    void resizeOffscreenFB();
+    // Fence the targets of the frames executed since, then display the newest completed one.
+    // The worker fences its frames itself: they are executed once the GPU completed them.
+    uint32_t executed = bgfxGlobal.m_executedFrames;
+    if (bgfxGlobal.m_workerContext)
+        executed = bgfxGlobal.pollFrameFences(m_glcontext->extraFunctions());
+    int newest = -1;
+    for (int ii = 0; ii < m_targetCount; ++ii)
+    {
+        OffscreenTarget& target = m_targets[ii];
+        if (target.state == OffscreenTarget::Recorded && int32_t(executed - target.frame) >= 0)
+        {
+            insertFence(target);
+            target.state = OffscreenTarget::Submitted;
+        }
+        if (target.state == OffscreenTarget::Submitted && isFenceSignaled(target)
+            && (newest < 0 || int32_t(target.frame - m_targets[newest].frame) > 0))
+        {
+            newest = ii;
+        }
+    }
+    if (newest < 0)
+        return;
 
-    // --- Synchronized Framebuffer
-    bgfx::FrameBufferHandle offscreenFB = BGFX_INVALID_HANDLE;
-    bgfx::TextureHandle backBuffer = BGFX_INVALID_HANDLE;
-    bgfx::TextureHandle depthBuffer = BGFX_INVALID_HANDLE;
-    uintptr_t backBufferNative = 0;
-    uintptr_t depthBufferNative = 0;
-    // --- 
-};
+    // The GPU executes in order: older submitted targets are complete and outdated
+    for (int ii = 0; ii < m_targetCount; ++ii)
+    {
+        OffscreenTarget& target = m_targets[ii];
+        if (target.state == OffscreenTarget::Displayed
+            || (target.state == OffscreenTarget::Submitted && int32_t(m_targets[newest].frame - target.frame) > 0))
+        {
+            target.state = OffscreenTarget::Free;
+        }
+    }
+    m_targets[newest].state = OffscreenTarget::Displayed;
+    m_displayedTarget = newest;
+}
 
 /******************************************************************************/
-BgfxItem::BgfxItem()
-: mRenderer(nullptr)
+void bgfxRenderer::insertFence(OffscreenTarget& pTarget)
 {
-    connect(this, &QQuickItem::windowChanged, this, &BgfxItem::handleWindowChanged);
+    if (bgfxGlobal.m_threadingMode == ThreadingMode::WorkerThread)
+        return; // fenced by the worker, see updateTargets()
+#ifdef _WIN32
+    if (bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
+    {
+        if (!pTarget.query)
+        {
+            D3D11_QUERY_DESC desc = { D3D11_QUERY_EVENT, 0 };
+            HRESULT_CHECK(m_device->CreateQuery(&desc, &pTarget.query));
+        }
+        m_context->End(pTarget.query);
+    }
+    else
+#endif
+    if (bgfxGlobal.m_backend == bgfx::RendererType::OpenGL)
+    {
+        QOpenGLExtraFunctions* gl = m_glcontext->extraFunctions();
+        if (pTarget.sync)
+            gl->glDeleteSync(pTarget.sync);
+        pTarget.sync = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
 }
 
 /******************************************************************************/
-QSGNode* BgfxItem::updatePaintNode(QSGNode* node, UpdatePaintNodeData* data)
+// Polled without waiting, the commands are flushed by Qt's present
+bool bgfxRenderer::isFenceSignaled(OffscreenTarget& pTarget)
 {
-    QSGNode* r = QQuickItem::updatePaintNode(node, data);
-    update(); // render every frame
-    return r;
+    if (bgfxGlobal.m_threadingMode == ThreadingMode::WorkerThread)
+        return true;
+#ifdef _WIN32
+    if (bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
+    {
+        BOOL done = FALSE;
+        return pTarget.query && m_context->GetData(pTarget.query, &done, sizeof(done), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK && done;
+    }
+    else
+#endif
+    if (bgfxGlobal.m_backend == bgfx::RendererType::OpenGL)
+    {
+        if (!pTarget.sync)
+            return false;
+        const GLenum status = m_glcontext->extraFunctions()->glClientWaitSync(pTarget.sync, 0, 0);
+        return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+    }
+    return true; // Noop, nothing runs on a GPU
 }
 
 /******************************************************************************/
-void BgfxItem::handleWindowChanged(QQuickWindow *win)
+void bgfxRenderer::releaseFences()
 {
-    if (win) {
-        connect(win, &QQuickWindow::beforeSynchronizing, this, &BgfxItem::sync, Qt::DirectConnection);
-        connect(win, &QQuickWindow::sceneGraphInvalidated, this, &BgfxItem::cleanup, Qt::DirectConnection);
-
-        // Ensure we start with cleared to black. The squircle's blend mode relies on this.
-        win->setColor(Qt::black);
+    const bool glCurrent = m_glcontext && QOpenGLContext::currentContext() == m_glcontext;
+    for (OffscreenTarget& target : m_targets)
+    {
+#ifdef _WIN32
+        SAFE_RELEASE(target.query);
+#endif
+        if (target.sync && glCurrent)
+            m_glcontext->extraFunctions()->glDeleteSync(target.sync);
+        target.sync = nullptr;
     }
 }
 
 /******************************************************************************/
-bgfxRenderer::bgfxRenderer()
+bgfx::TextureHandle bgfxRenderer::displayedColor() const
 {
+    QMutexLocker lock(&m_targetsMutex);
+    return m_displayedTarget >= 0 ? m_targets[m_displayedTarget].color : bgfx::TextureHandle(BGFX_INVALID_HANDLE);
 }
 
 /******************************************************************************/
-// The safe way to release custom graphics resources it to both connect to
-// sceneGraphInvalidated() and implement releaseResources(). To support
-// threaded render loops the latter performs the bgfxRenderer destruction
-// via scheduleRenderJob(). Note that the bgfxItem may be gone by the time
-// the QRunnable is invoked.
-void BgfxItem::cleanup()
+// Direct3D11 OffscreenFramebuffer composites with CopySubresourceRegion, which can't scale
+bool bgfxRenderer::canScale() const
 {
-    delete mRenderer;
-    mRenderer = nullptr;
+    return bgfxGlobal.rendersOffscreen()
+        && !(bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11 && m_interopMode == InteropMode::OffscreenFramebuffer);
 }
 
 /******************************************************************************/
-class CleanupJob : public QRunnable
+float bgfxRenderer::effectiveScale(const SceneParams& pScene) const
 {
-public:
-    CleanupJob(bgfxRenderer* pRenderer) : mRenderer(pRenderer) { }
-    void run() override { delete mRenderer; }
-private:
-    bgfxRenderer * mRenderer;
-};
+    if (pScene.targetFrameMs <= 0.f || !canScale())
+        return 1.f;
+    return std::max(std::min(m_renderScale.load(), pScene.maxScale), pScene.minScale);
+}
 
 /******************************************************************************/
-void BgfxItem::releaseResources()
+void bgfxRenderer::updateRenderScale(const FrameSample& pSample, const SceneParams& pScene)
 {
-    window()->scheduleRenderJob(new CleanupJob(mRenderer), QQuickWindow::BeforeSynchronizingStage);
-    mRenderer = nullptr;
+    // bgfx timings are the ones of the last executed frame, one sample per frame
+    if (pSample.gpuMs <= 0.f || pSample.frame == m_scaleFrame)
+        return;
+    m_scaleFrame = pSample.frame;
+    if (m_scaleSettle > 0)
+    {
+        --m_scaleSettle;
+        return;
+    }
+
+    m_smoothedGpuMs = m_smoothedGpuMs > 0.f ? m_smoothedGpuMs + 0.1f * (pSample.gpuMs - m_smoothedGpuMs) : pSample.gpuMs;
+    const float current = effectiveScale(pScene);
+    float scale = current;
+    if (pSample.gpuMs > pScene.targetFrameMs)
+        scale = current * std::sqrt(pScene.targetFrameMs / pSample.gpuMs) * 0.95f; // below, the load may keep rising
+    else if (m_smoothedGpuMs < pScene.targetFrameMs * 0.8f)
+        scale = current * std::min(1.05f, std::sqrt(pScene.targetFrameMs * 0.9f / m_smoothedGpuMs));
+    scale = std::round(scale / ScaleStep) * ScaleStep;
+    scale = std::max(std::min(scale, pScene.maxScale), pScene.minScale);
+    if (scale != current)
+    {
+        m_renderScale = scale;
+        m_scaleSettle = ScaleSettleFrames;
+        m_smoothedGpuMs = 0.f; // measured again at the new scale
+    }
 }
 
 /******************************************************************************/
-bgfxRenderer::~bgfxRenderer()
+void bgfxRenderer::capture(int pTarget, const std::shared_ptr<BgfxCaptureSink>& pSink)
 {
-    qDebug("cleanup");
-    /* crash
-    bgfxExample.shutdown();
-
-    if (bgfx::isValid(backBuffer))
-        bgfx::destroy(backBuffer);
+    const uint64_t caps = BGFX_CAPS_TEXTURE_BLIT | BGFX_CAPS_TEXTURE_READ_BACK;
+    if ((bgfx::getCaps()->supported & caps) != caps || !bgfxGlobal.rendersOffscreen() || m_activeConfig.color != bgfx::TextureFormat::RGBA8)
+    {
+        if (!m_captureWarned)
+            qWarning("bgfx capture requires an offscreen InteropMode, an RGBA8 target and texture blit/read back support");
+        m_captureWarned = true;
+        return;
+    }
 
-    if (bgfx::isValid(depthBuffer))
-        bgfx::destroy(depthBuffer);
+    CaptureSlot* slot = nullptr;
+    for (CaptureSlot& candidate : m_captureSlots)
+    {
+        if (candidate.state == CaptureSlot::Free)
+        {
+            slot = &candidate;
+            break;
+        }
+    }
+    if (!slot)
+        return; // dropped
 
-    if (bgfx::isValid(offscreenFB))
-        bgfx::destroy(offscreenFB);
+    const OffscreenTarget& target = m_targets[pTarget];
+    if (slot->textureSize != target.size)
+    {
+        if (bgfx::isValid(slot->texture))
+            bgfx::destroy(slot->texture);
+        slot->textureSize = target.size;
+        slot->texture = bgfx::createTexture2D(uint16_t(target.size.width()), uint16_t(target.size.height()), false, 1, bgfx::TextureFormat::RGBA8,
+            BGFX_TEXTURE_BLIT_DST | BGFX_TEXTURE_READ_BACK | BGFX_SAMPLER_MIN_POINT | BGFX_SAMPLER_MAG_POINT | BGFX_SAMPLER_MIP_POINT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP);
+        slot->buffer.resize(size_t(target.size.width()) * target.size.height() * 4);
+    }
 
-    bgfx::frame();
-    */
+    // Blits run in view order: after the item views, before the next frame reuses the target
+    const QRect rect = targetRect(target.size);
+    bgfx::blit(captureView(), slot->texture, 0, 0, target.color, uint16_t(rect.left()), uint16_t(rect.top()), uint16_t(rect.width()), uint16_t(rect.height()));
+    slot->readyFrame = bgfx::readTexture(slot->texture, slot->buffer.data());
+    slot->frame = target.frame;
+    slot->sink = pSink;
+    slot->state = CaptureSlot::Reading;
 }
 
 /******************************************************************************/
-void BgfxItem::sync()
+void bgfxRenderer::pollCaptures()
 {
-    if (!mRenderer) {
-        mRenderer = new bgfxRenderer;
-        connect(window(), &QQuickWindow::beforeRendering, mRenderer, &bgfxRenderer::frameStart, Qt::DirectConnection);
-        connect(window(), &QQuickWindow::beforeRenderPassRecording, mRenderer, &bgfxRenderer::mainPassRecordingStart, Qt::DirectConnection);
+    // Slots are delivered in frame order, the oldest first
+    for (;;)
+    {
+        CaptureSlot* oldest = nullptr;
+        for (CaptureSlot& slot : m_captureSlots)
+        {
+            if (slot.state == CaptureSlot::Reading && int32_t(bgfxGlobal.m_frameNumber - slot.readyFrame) >= 0
+                && (!oldest || int32_t(slot.frame - oldest->frame) < 0))
+            {
+                oldest = &slot;
+            }
+        }
+        if (!oldest)
+            return;
+
+        CaptureSlot* slot = oldest;
+        slot->state = CaptureSlot::Delivering;
+        const bool bottomUp = bgfxGlobal.m_backend == bgfx::RendererType::OpenGL;
+        m_captureThread.start(new FunctionJob([slot, bottomUp]
+        {
+            const int width = slot->textureSize.width();
+            const int height = slot->textureSize.height();
+            const size_t stride = size_t(width) * 4;
+            if (bottomUp)
+            {
+                // GL textures are stored bottom-up, flip in place
+                for (int yy = 0; yy < height / 2; ++yy)
+                {
+                    uint8_t* top = slot->buffer.data() + yy * stride;
+                    uint8_t* bottom = slot->buffer.data() + (height - 1 - yy) * stride;
+                    std::swap_ranges(top, top + stride, bottom);
+                }
+            }
+            const QImage image(slot->buffer.data(), width, height, int(stride), QImage::Format_RGBA8888);
+            slot->sink->frameCaptured(image, slot->frame);
+            slot->sink.reset();
+            slot->state = CaptureSlot::Free;
+        }));
     }
-    mRenderer->setViewportSize(window()->size() * window()->devicePixelRatio());
-    mRenderer->setWindow(window());
 }
 
-
 /******************************************************************************/
-void bgfxRenderer::resizeOffscreenFB()
+bool bgfxRenderer::hasPendingReadback() const
 {
-    if (bgfx::isValid(offscreenFB))
+    for (const CaptureSlot& slot : m_captureSlots)
     {
-        bgfx::destroy(offscreenFB);
-        offscreenFB = BGFX_INVALID_HANDLE;
+        if (slot.state == CaptureSlot::Reading)
+            return true;
     }
+    return false;
+}
 
-    if (bgfx::isValid(backBuffer))
+/******************************************************************************/
+// API thread, once the renderer is unregistered
+void bgfxRenderer::releaseCaptures()
+{
+    m_captureThread.waitForDone();
+    for (CaptureSlot& slot : m_captureSlots)
     {
-        bgfx::destroy(backBuffer);
-        backBuffer = BGFX_INVALID_HANDLE;
+        if (slot.state == CaptureSlot::Reading && bgfxGlobal.m_initialized)
+            bgfxGlobal.orphanReadback(slot.readyFrame, std::move(slot.buffer));
+        if (bgfx::isValid(slot.texture) && bgfxGlobal.m_initialized)
+            bgfx::destroy(slot.texture);
+        slot.texture = BGFX_INVALID_HANDLE;
+        slot.sink.reset();
+        slot.state = CaptureSlot::Free;
     }
+}
 
-    if (bgfx::isValid(depthBuffer))
+/******************************************************************************/
+uintptr_t bgfxRenderer::compositeTexture() const
+{
+    const bgfx::TextureHandle color = displayedColor();
+    return bgfx::isValid(color) ? bgfx::getInternal(color) : 0;
+}
+
+/******************************************************************************/
+bool bgfxRenderer::hasFrameInFlight() const
+{
+    if (m_pendingRecords > 0 || hasPendingReadback())
+        return true;
+    // Recorded into a tick another item completes: bgfx::frame() didn't run yet
+    if (int32_t(m_recordedFrame - bgfxGlobal.m_executedFrames) > 0)
+        return true;
+    QMutexLocker lock(&m_targetsMutex);
+    for (int ii = 0; ii < m_targetCount; ++ii)
     {
-        bgfx::destroy(depthBuffer);
-        backBuffer = BGFX_INVALID_HANDLE;
+        if (m_targets[ii].state == OffscreenTarget::Recorded || m_targets[ii].state == OffscreenTarget::Submitted)
+            return true;
     }
-
-    backBuffer = bgfx::createTexture2D(m_viewportSize.width(), m_viewportSize.height(), false, 1, bgfx::TextureFormat::RGBA8, BGFX_TEXTURE_RT, NULL);
-    depthBuffer = bgfx::createTexture2D(m_viewportSize.width(), m_viewportSize.height(), false, 1, bgfx::TextureFormat::D24S8, BGFX_TEXTURE_RT, NULL);
-    bgfx::TextureHandle fbtextures[2] = { backBuffer, depthBuffer };
-    offscreenFB = bgfx::createFrameBuffer(BX_COUNTOF(fbtextures), fbtextures, false);
-    bgfx::setViewFrameBuffer(0, offscreenFB);
+    return false;
 }
 
 /******************************************************************************/
 void bgfxRenderer::resize()
 {
-    if (bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
+    bgfxGlobal.call([this] { resize_Backend(); });
+}
+
+/******************************************************************************/
+void bgfxRenderer::resize_Backend()
+{
+    if (viewsExhausted())
+        return;
+    if (bgfxGlobal.m_backend == bgfx::RendererType::Noop)
+    {
+        resizeOffscreenFB();
+    }
+#ifdef _WIN32
+    else if (bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
     {
         switch (m_interopMode)
         {
         case InteropMode::ExternPlatform: resize_ExternPlatform_DX11(); break;
         case InteropMode::SynchroFramebuffer: resize_SynchroFramebuffer_DX11(); break;
-        case InteropMode::OffscreenFramebuffer: resize_OffscreenFramebuffer_DX11(); break;
+        case InteropMode::OffscreenFramebuffer:
+        case InteropMode::TextureNode:
+        case InteropMode::TextureAtlas: resize_OffscreenFramebuffer_DX11(); break;
         default:
             break;
         }
     }
+#endif
     else
     {
         switch (m_interopMode)
         {
         case InteropMode::ExternPlatform: resize_ExternPlatform_GL(); break;
         case InteropMode::SynchroFramebuffer: resize_SynchroFramebuffer_GL(); break;
-        case InteropMode::OffscreenFramebuffer: resize_OffscreenFramebuffer_GL(); break;
+        case InteropMode::OffscreenFramebuffer:
+        case InteropMode::TextureNode:
+        case InteropMode::TextureAtlas: resize_OffscreenFramebuffer_GL(); break;
         default:
             break;
         }
@@ -311,7 +2473,17 @@ void bgfxRenderer::resize()
 void bgfxRenderer::frameStart()
 {
     QSGRendererInterface *rif = m_window->rendererInterface();
-    if (rif->graphicsApi() == QSGRendererInterface::Direct3D11Rhi)
+    if (bgfxGlobal.m_backend == bgfx::RendererType::Noop)
+    {
+        // Qt software scene graph: no device to share, and no render pass signal
+        if (!m_initialized)
+            init();
+        if (!viewsExhausted())
+            render_Noop();
+        return;
+    }
+#ifdef _WIN32
+    else if (rif->graphicsApi() == QSGRendererInterface::Direct3D11Rhi)
     {
         Q_ASSERT(rif->graphicsApi() == QSGRendererInterface::Direct3D11Rhi);
 
@@ -327,17 +2499,50 @@ void bgfxRenderer::frameStart()
         if (!m_initialized)
             init();
     }
+#endif
     else
     {
         Q_ASSERT(rif->graphicsApi() == QSGRendererInterface::OpenGLRhi);
         m_glcontext = reinterpret_cast<QOpenGLContext*>(rif->getResource(m_window, QSGRendererInterface::OpenGLContextResource));
-        bool success = m_glcontext->nativeHandle().canConvert<QWGLNativeContext>();
-        Q_ASSERT(success);
-        QWGLNativeContext native = m_glcontext->nativeHandle().value<QWGLNativeContext>();
-        m_nativeglcontext = (void*)native.context();
+        const NativeGLContext native = nativeGLContext(m_glcontext);
+        m_nativeglcontext = native.context;
+        m_nativedisplay = native.display;
+        // Refused or unsupported context (logged by nativeGLContext), the item isn't rendered
+        if (!m_nativeglcontext)
+            return;
         if (!m_initialized)
             init();        
     }
+
+    if (bgfxGlobal.samplesOffscreen() && !viewsExhausted())
+        render_TextureNode();
+}
+
+/******************************************************************************/
+// bgfx Noop renderer (benchmarks): record and submit only, there is nothing to composite
+void bgfxRenderer::render_Noop()
+{
+    render_Common();
+    updateTargets();
+
+    if (m_renderPolicy == BgfxItem::Continuous)
+        m_window->update();
+}
+
+/******************************************************************************/
+// Render to the offscreen framebuffer before Qt's main pass, the BgfxTextureNode
+// samples it during the pass: no copy into Qt's render target, no flush.
+void bgfxRenderer::render_TextureNode()
+{
+    m_window->beginExternalCommands();
+
+    render_Common();
+    updateTargets();
+
+    if (bgfxGlobal.m_backend != bgfx::RendererType::Direct3D11)
+        m_window->resetOpenGLState();
+
+    m_window->endExternalCommands();
 }
 
 static const float vertices[] = {
@@ -373,6 +2578,7 @@ void bgfxRenderer::render_ExternPlatform_GL()
 
     bgfx::PlatformData pdata;
     //pdata.nwh = (void*)wid;
+    pdata.ndt = m_nativedisplay;
     pdata.context = m_nativeglcontext;
     bgfx::setPlatformData(pdata);
 
@@ -380,7 +2586,7 @@ void bgfxRenderer::render_ExternPlatform_GL()
     // reset works but is to bad
     // bgfx::reset(m_viewportSize.width(), m_viewportSize.height());
 
-    bgfx::setViewFrameBuffer(0, BGFX_INVALID_HANDLE);
+    bgfx::setViewFrameBuffer(m_viewId, BGFX_INVALID_HANDLE);
     //bgfx::reset(m_viewportSize.width(), m_viewportSize.height(), BGFX_RESET_NONE);        
     
     render_Common();
@@ -399,31 +2605,67 @@ void bgfxRenderer::render_OffscreenFramebuffer_GL()
 {
     // glGet(Framebuffer blabla)
 
-    bgfx::setViewFrameBuffer(0, offscreenFB);
     render_Common();
+    updateTargets();
 
     //QOpenGLFunctions* gl = m_glcontext->functions();
     QOpenGLExtraFunctions* gl = m_glcontext->extraFunctions();
 
-    // Add a method to retrieve the handle of the FrameBuffer
-    //uintptr_t handle = bgfx::getInternal(offscreenFB); 
-    // BGFX store framebuffer id in the s_contex->m_frameBuffers[handle].m_fbo[0]
-    // m_fbo[1] is the id of the resolved frame buffer if have one (MSAA), we should use this one if available
-    // Here we don't check if it's a renderbuffer or a framebuffer
-    uintptr_t attch0 = bgfx::getInternal(backBuffer);
-    GLuint srcFB;
-    gl->glGenFramebuffers(1, &srcFB); GL_CHECK();
-    gl->glBindFramebuffer(GL_FRAMEBUFFER, srcFB); GL_CHECK();
-    gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, attch0, 0); GL_CHECK();
-    //gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0); GL_CHECK();
-    GLenum status = gl->glCheckFramebufferStatus(GL_FRAMEBUFFER); GL_CHECK();
-    assert(status == GL_FRAMEBUFFER_COMPLETE);
+    // The color texture is the single sample one: with MSAA, bgfx already resolved the
+    // frame into it (its m_fbo[1]), the blit below is a plain copy
+    const bgfx::TextureHandle color = displayedColor();
+    uintptr_t attch0 = bgfx::isValid(color) ? bgfx::getInternal(color) : 0;
+    if (attch0 == 0)
+        return; // texture not created yet or no frame completed, bgfx frame still pending
+
+    // The blit framebuffer is kept between frames, the color attachment is only
+    // updated when the texture changed (reset by resize_OffscreenFramebuffer_GL)
+    if (m_blitFB == 0)
+    {
+        gl->glGenFramebuffers(1, &m_blitFB); GL_CHECK();
+    }
+    if (m_blitFBTexture != attch0)
+    {
+        gl->glBindFramebuffer(GL_FRAMEBUFFER, m_blitFB); GL_CHECK();
+        gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, attch0, 0); GL_CHECK();
+        //gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0); GL_CHECK();
+        GLenum status = gl->glCheckFramebufferStatus(GL_FRAMEBUFFER); GL_CHECK();
+        assert(status == GL_FRAMEBUFFER_COMPLETE);
+        Q_UNUSED(status);
+        m_blitFBTexture = attch0;
+    }
+
+    // Upscaled when rendered at a lower resolution (dynamic resolution)
+    const QRect src = offscreenRect();
+    const GLenum filter = src.size() == m_viewportSize ? GL_NEAREST : GL_LINEAR;
+    gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, m_blitFB); GL_CHECK();
+    if (filter == GL_LINEAR)
+    {
+        // Linear filtering reads a texel past the rendered rect, which holds stale content:
+        // duplicate the rect's edges into it, rows first then the columns with the corners
+        // (non-overlapping blits within the same framebuffer)
+        gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_blitFB); GL_CHECK();
+        auto copy = [gl](int pSrcX, int pSrcY, int pDstX, int pDstY, int pWidth, int pHeight)
+        {
+            gl->glBlitFramebuffer(pSrcX, pSrcY, pSrcX + pWidth, pSrcY + pHeight, pDstX, pDstY, pDstX + pWidth, pDstY + pHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST); GL_CHECK();
+        };
+        const int x0 = src.left(), x1 = src.left() + src.width();
+        const int y0 = src.top(), y1 = src.top() + src.height();
+        if (y0 > 0)
+            copy(x0, y0, x0, y0 - 1, src.width(), 1);
+        if (y1 < m_offscreenSize.height())
+            copy(x0, y1 - 1, x0, y1, src.width(), 1);
+        const int rowsBegin = std::max(y0 - 1, 0), rowsEnd = std::min(y1 + 1, m_offscreenSize.height());
+        if (x0 > 0)
+            copy(x0, rowsBegin, x0 - 1, rowsBegin, 1, rowsEnd - rowsBegin);
+        if (x1 < m_offscreenSize.width())
+            copy(x1 - 1, rowsBegin, x1, rowsBegin, 1, rowsEnd - rowsBegin);
+    }
+
     // Only blit the color buffer (attachement 0)
-    gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, srcFB); GL_CHECK();
     gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); GL_CHECK();
-    gl->glBlitFramebuffer(0, 0, m_viewportSize.width(), m_viewportSize.height(), 0, 0, m_viewportSize.width(), m_viewportSize.height(), GL_COLOR_BUFFER_BIT, GL_NEAREST); GL_CHECK();
+    gl->glBlitFramebuffer(src.left(), src.top(), src.left() + src.width(), src.top() + src.height(), 0, 0, m_viewportSize.width(), m_viewportSize.height(), GL_COLOR_BUFFER_BIT, filter); GL_CHECK();
     gl->glBindFramebuffer(GL_FRAMEBUFFER, 0); GL_CHECK();
-    gl->glDeleteFramebuffers(1,&srcFB); GL_CHECK();
 }
 
 /******************************************************************************/
@@ -431,11 +2673,12 @@ void bgfxRenderer::resize_ExternPlatform_GL()
 {
     bgfx::PlatformData pdata;
     //pdata.nwh = (void*)m_window->winId(); // nwh = null -> bgfx consider external context
+    pdata.ndt = m_nativedisplay;
     pdata.context = m_nativeglcontext;
     bgfx::setPlatformData(pdata);
     // It's not a good usage to do this every frame
     // We should call this on resize event only
-    bgfx::setViewFrameBuffer(0, BGFX_INVALID_HANDLE);
+    bgfx::setViewFrameBuffer(m_viewId, BGFX_INVALID_HANDLE);
     bgfx::reset(m_viewportSize.width(), m_viewportSize.height());  
     bgfx::frame();
 }
@@ -445,12 +2688,13 @@ void bgfxRenderer::resize_SynchroFramebuffer_GL()
 {
     bgfx::PlatformData pdata;
     //pdata.nwh = (void*)m_window->winId(); // nwh = null -> bgfx consider external context
+    pdata.ndt = m_nativedisplay;
     pdata.context = m_nativeglcontext;
     bgfx::setPlatformData(pdata);
     // not necessary with the 'proto-bgfx' branch (modification in renderer_d3d11->udpateResolution)
     // It's not a good usage to do this every frame
     // We should call this on resize event only
-    bgfx::setViewFrameBuffer(0, offscreenFB);
+    bgfx::setViewFrameBuffer(m_viewId, offscreenFB);
     bgfx::reset(m_viewportSize.width(), m_viewportSize.height());
     bgfx::frame();
 }
@@ -458,10 +2702,11 @@ void bgfxRenderer::resize_SynchroFramebuffer_GL()
 /******************************************************************************/
 void bgfxRenderer::resize_OffscreenFramebuffer_GL()
 {
-    resizeOffscreenFB(),
-    bgfx::setViewFrameBuffer(0, offscreenFB);
+    // The view framebuffer is set per recording, see acquireTarget()
+    resizeOffscreenFB();
 }
 
+#ifdef _WIN32
 /******************************************************************************/
 void bgfxRenderer::resize_ExternPlatform_DX11()
 {
@@ -476,7 +2721,7 @@ void bgfxRenderer::resize_ExternPlatform_DX11()
     pdata.backBuffer = pRenderTarget[0];
     pdata.backBufferDS = pDepthTarget[0];
     bgfx::setPlatformData(pdata);
-    bgfx::setViewFrameBuffer(0, BGFX_INVALID_HANDLE);
+    bgfx::setViewFrameBuffer(m_viewId, BGFX_INVALID_HANDLE);
    
 
     // not necessary with the 'proto-bgfx' branch (modification in renderer_d3d11->udpateResolution)
@@ -500,7 +2745,7 @@ void bgfxRenderer::resize_ExternPlatform_DX11()
 /******************************************************************************/
 void bgfxRenderer::resize_SynchroFramebuffer_DX11()
 {
-    bgfx::setViewFrameBuffer(0, offscreenFB);
+    bgfx::setViewFrameBuffer(m_viewId, offscreenFB);
     bgfx::reset(m_viewportSize.width(), m_viewportSize.height());
     bgfx::frame();
 
@@ -509,19 +2754,181 @@ void bgfxRenderer::resize_SynchroFramebuffer_DX11()
 /******************************************************************************/
 void bgfxRenderer::resize_OffscreenFramebuffer_DX11()
 {
-    resizeOffscreenFB(),
-    bgfx::setViewFrameBuffer(0, offscreenFB);
+    // The view framebuffer is set per recording, see acquireTarget()
+    resizeOffscreenFB();
     //bgfx::reset(m_viewportSize.width(), m_viewportSize.height());
     //bgfx::frame();
 }
+#endif // _WIN32
 
 /******************************************************************************/
 void bgfxRenderer::render_Common()
 {
-    bgfxExample.setSize(m_viewportSize.width(), m_viewportSize.height());
-    bgfxExample.update();
+    SceneParams scene = m_scene;
+    scene.viewportSize = m_viewportSize;
+    const float scale = effectiveScale(scene);
+    if (scale != 1.f)
+        scene.viewportSize = QSize(std::max(1, qRound(m_viewportSize.width() * scale)), std::max(1, qRound(m_viewportSize.height() * scale)));
+
+    // Nothing changed: the offscreen target still holds the last frame, composite it again.
+    // Modes rendering into Qt's render target have to record every time.
+    const bool contentChanged = m_contentChanged.exchange(false);
+    const bool reuse = !m_dirty && !contentChanged && m_renderPolicy != BgfxItem::Continuous && bgfxGlobal.rendersOffscreen();
+    m_dirty = false;
+
+    if (bgfxGlobal.m_threadingMode != ThreadingMode::SingleThread)
+    {
+        // Execute the last frame submitted by the API thread, if any, then let the API
+        // thread record the next one while Qt composites this one. In WorkerThread mode
+        // the API thread executes it, this render thread is one of several.
+        if (bgfxGlobal.m_threadingMode == ThreadingMode::MultiThread)
+            bgfx::renderFrame(0);
+        ++m_pendingRecords;
+        bgfxGlobal.post([this, scene, reuse] { reuse ? skipRecord() : record(scene); --m_pendingRecords; });
+        // Composited by a later Qt frame, see BgfxItem::sync()
+        if (!reuse)
+            m_window->update();
+        return;
+    }
+
+    reuse ? skipRecord() : record(scene);
+    // The other items of the tick kick bgfx::frame(), this window composited the previous
+    // frame: render again once it executed (recording nothing new, see BgfxItem::sync())
+    if (int32_t(m_recordedFrame - bgfxGlobal.m_executedFrames) > 0)
+        m_window->update();
+}
+
+/******************************************************************************/
+void bgfxRenderer::skipRecord()
+{
+    bgfxGlobal.beginRecording(this);
+    pollCaptures();
+    // Readbacks complete with the next bgfx frames, keep them coming
+    bgfxGlobal.endRecording(this, hasPendingReadback());
+}
+
+/******************************************************************************/
+void bgfxRenderer::record(const SceneParams& pScene)
+{
+    const int64_t start = bx::getHPCounter();
+    bgfxGlobal.beginRecording(this);
+    pollCaptures();
+    if (pScene.background != m_backgroundPath)
+        loadBackground(pScene.background);
+    m_recordedSize = pScene.viewportSize;
+    if (m_backgroundStream)
+    {
+        float lod[4];
+        bgfxGlobal.setStreamTargetSize(this, m_backgroundStream, pScene.viewportSize);
+        m_backgroundStream->lod(lod);
+        bgfxExample.setBackground(m_backgroundStream->handle(), lod);
+    }
+    m_loading = m_backgroundTicket != bgfxResourceLoader::InvalidTicket || (m_backgroundStream && !m_backgroundStream->isComplete());
+    const int target = bgfxGlobal.rendersOffscreen() ? acquireTarget(pScene.viewportSize) : -1;
+    if (target >= 0)
+        bgfx::setViewFrameBuffer(m_viewId, m_targets[target].fb);
+    bgfxExample.setGridSize(pScene.gridSize);
+    bgfxExample.setInstanced(pScene.instanced);
+    bgfxExample.setOcclusionCulling(pScene.occlusionCulling);
+    bgfxExample.setSize(pScene.viewportSize.width(), pScene.viewportSize.height());
+    bgfxExample.setOrigin(m_targetOrigin.x(), m_targetOrigin.y());
+
+    // Each item records through its own encoder
+    bgfx::Encoder* encoder = bgfx::begin(true);
+    bgfxExample.update(encoder);
+    bgfx::end(encoder);
+    if (pScene.captureSink)
+        capture(target, pScene.captureSink);
+    const int64_t end = bx::getHPCounter();
+
+    m_recordedFrame = bgfxGlobal.m_submittedFrames + 1; // recorded into the next bgfx::frame()
+    bgfxGlobal.endRecording(this);
+
+    // bgfx timings are the ones of the last executed frame, shared by all items
+    FrameSample sample = bgfxGlobal.m_lastFrame;
+    sample.recordMs = float(double(end - start) * 1000.0 / double(bx::getHPFrequency()));
+    if (pScene.targetFrameMs > 0.f)
+        updateRenderScale(sample, pScene);
+    QMutexLocker lock(&m_statsMutex);
+    m_statsHistory.add(sample);
+}
+
+/******************************************************************************/
+// The frame is recorded without background until the coarsest mip is uploaded, finer
+// ones are streamed in up to the viewport size
+void bgfxRenderer::loadBackground(const QString& pPath)
+{
+    releaseBackground();
+    m_backgroundPath = pPath;
+    if (pPath.isEmpty())
+        return;
+
+    m_backgroundTicket = bgfxGlobal.m_loader.loadMips(pPath, [this](std::shared_ptr<const MipChain> pMips)
+    {
+        m_backgroundTicket = bgfxResourceLoader::InvalidTicket;
+        if (pMips)
+        {
+            m_backgroundStream = bgfxGlobal.acquireStream(this, std::move(pMips), [this] { m_contentChanged = true; });
+            bgfxGlobal.setStreamTargetSize(this, m_backgroundStream, m_recordedSize);
+        }
+        m_contentChanged = true;
+    });
+}
+
+/******************************************************************************/
+void bgfxRenderer::releaseBackground()
+{
+    bgfxGlobal.m_loader.cancel(m_backgroundTicket);
+    m_backgroundTicket = bgfxResourceLoader::InvalidTicket;
+    bgfxExample.setBackground(BGFX_INVALID_HANDLE, nullptr);
+    if (m_backgroundStream)
+    {
+        bgfxGlobal.releaseStream(this, m_backgroundStream);
+        m_backgroundStream = nullptr;
+    }
+}
+
+/******************************************************************************/
+BgfxFrameStats bgfxRenderer::stats() const
+{
+    QMutexLocker lock(&m_statsMutex);
+    BgfxFrameStats stats;
+    if (m_statsHistory.isEmpty())
+        return stats;
+
+    // Called every frame: the percentiles of 600 samples barely move between two
+    const int64_t now = bx::getHPCounter();
+    if (now - m_statsPercentilesTime >= StatsPercentilesPeriodMs * bx::getHPFrequency() / 1000)
+    {
+        m_statsPercentilesTime = now;
+        const float percents[] = { 50.f, 95.f, 99.f };
+        float values[3];
+        m_statsHistory.percentiles(&FrameSample::recordMs, percents, values, 3);
+        m_statsPercentiles.recordTimeP50 = values[0];
+        m_statsPercentiles.recordTimeP95 = values[1];
+        m_statsPercentiles.recordTimeP99 = values[2];
+        m_statsHistory.percentiles(&FrameSample::frameMs, percents, values, 3);
+        m_statsPercentiles.frameTimeP50 = values[0];
+        m_statsPercentiles.frameTimeP95 = values[1];
+        m_statsPercentiles.frameTimeP99 = values[2];
+        m_statsHistory.percentiles(&FrameSample::gpuMs, percents, values, 3);
+        m_statsPercentiles.gpuTimeP50 = values[0];
+        m_statsPercentiles.gpuTimeP95 = values[1];
+        m_statsPercentiles.gpuTimeP99 = values[2];
+    }
+
+    const FrameSample& last = m_statsHistory.last();
+    stats = m_statsPercentiles;
+    stats.recordTime = last.recordMs;
+    stats.frameTime = last.frameMs;
+    stats.gpuTime = last.gpuMs;
+    stats.waitRenderTime = last.waitRenderMs;
+    stats.waitSubmitTime = last.waitSubmitMs;
+    stats.drawCalls = int(last.numDraw);
+    return stats;
 }
 
+#ifdef _WIN32
 /******************************************************************************/
 // Use platformData to set backBuffer
 void bgfxRenderer::render_ExternPlatform_DX11()
@@ -541,7 +2948,7 @@ void bgfxRenderer::render_ExternPlatform_DX11()
     // It's not a good usage to do this every frame
     // We should call this on resize event only
     // bgfx::reset(m_viewportSize.width(), m_viewportSize.height(), BGFX_RESET_NONE);        
-    bgfx::setViewFrameBuffer(0, BGFX_INVALID_HANDLE);
+    bgfx::setViewFrameBuffer(m_viewId, BGFX_INVALID_HANDLE);
 
     render_Common();
 
@@ -638,7 +3045,7 @@ void bgfxRenderer::render_SynchroFramebuffer_DX11()
 
         m_needreset = false;
     }
-    bgfx::setViewFrameBuffer(0, offscreenFB);
+    bgfx::setViewFrameBuffer(m_viewId, offscreenFB);
 
     render_Common();
 
@@ -663,15 +3070,16 @@ void bgfxRenderer::render_OffscreenFramebuffer_DX11()
     ID3D11DepthStencilView* pDepthTarget[countRT] = {};
     m_context->OMGetRenderTargets(countRT, pRenderTarget, pDepthTarget); //OMGetRenderTargetsAndUnorderedAccessViews ?
 
-    bgfx::setViewFrameBuffer(0, offscreenFB);
     render_Common();
+    updateTargets();
 
     // Restore RenderTarget in case of MultiPass rendering leave a different output
     m_context->OMSetRenderTargets(countRT, pRenderTarget, pDepthTarget[0]);
     
     if (pRenderTarget[0])
     {
-        ID3D11Texture2D* backBufferTexture2D = (ID3D11Texture2D*)bgfx::getInternal(backBuffer);
+        const bgfx::TextureHandle color = displayedColor();
+        ID3D11Texture2D* backBufferTexture2D = bgfx::isValid(color) ? (ID3D11Texture2D*)bgfx::getInternal(color) : nullptr;
         if (backBufferTexture2D)
         {
             ID3D11Resource* src = {};
@@ -685,10 +3093,14 @@ void bgfxRenderer::render_OffscreenFramebuffer_DX11()
             ID3D11Resource* dst = {};
             pRenderTarget[0]->GetResource(&dst);
 
+            // No Flush(): the copy is queued on the same immediate context as Qt's
+            // commands, which submits them at the end of the frame.
+            // The offscreen target may be larger than the viewport: copy the rendered sub-rect
             if (src != nullptr && dst != nullptr)
             {
-                m_context->CopyResource(dst, src);
-                m_context->Flush();
+                const QRect rect = offscreenRect();
+                D3D11_BOX box = { UINT(rect.left()), UINT(rect.top()), 0, UINT(rect.left() + rect.width()), UINT(rect.top() + rect.height()), 1 };
+                m_context->CopySubresourceRegion(dst, 0, 0, 0, 0, src, 0, &box);
             }
 
             SAFE_RELEASE(dst);
@@ -703,14 +3115,26 @@ void bgfxRenderer::render_OffscreenFramebuffer_DX11()
         SAFE_RELEASE(pDepthTarget[i]);
     }
 }
+#endif // _WIN32
 
 /******************************************************************************/
 void bgfxRenderer::mainPassRecordingStart()
 {
-    //qDebug() << "mainPassRecordingStart tid=" << GetCurrentThreadId();
+    //qDebug() << "mainPassRecordingStart tid=" << QThread::currentThreadId();
+    if (viewsExhausted())
+        return;
+
+    if (bgfxGlobal.samplesOffscreen())
+    {
+        // Already rendered in frameStart(), nothing to blit
+        if (m_renderPolicy == BgfxItem::Continuous)
+            m_window->update();
+        return;
+    }
 
     m_window->beginExternalCommands();
 
+#ifdef _WIN32
     if (bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
     {
         switch (m_interopMode)
@@ -723,6 +3147,7 @@ void bgfxRenderer::mainPassRecordingStart()
         }
     }
     else
+#endif
     {
         switch (m_interopMode)
         {
@@ -738,7 +3163,8 @@ void bgfxRenderer::mainPassRecordingStart()
 
     m_window->endExternalCommands();  
 
-    m_window->update();
+    if (m_renderPolicy == BgfxItem::Continuous)
+        m_window->update();
 }
 
 /******************************************************************************/
@@ -747,35 +3173,48 @@ void bgfxRenderer::init()
     WId wid = m_window->winId();
     m_interopMode = bgfxGlobal.m_interopMode;
 
-    DWORD tid = GetCurrentThreadId();
-    qDebug() << "bgfxItem Thread " << tid;
+    qDebug() << "bgfxItem Thread " << QThread::currentThreadId();
     m_initialized = true;
+    m_targetRingSize = targetRingSize(m_framePacing);
 
     
 
     // init if not already done
+#ifdef _WIN32
     if (bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
     {
         bgfxGlobal.init(m_device);
     }
     else
+#endif
     {
-        bgfxGlobal.init(m_nativeglcontext);
+        bgfxGlobal.init(m_nativeglcontext, m_nativedisplay);
     }
 
-    if (m_interopMode == InteropMode::OffscreenFramebuffer)
+    bgfxGlobal.call([this, wid]
     {
+        m_viewId = bgfxGlobal.allocViews(ViewCount);
+        if (m_viewId == bgfxRendererGlobal::InvalidView)
+        {
+            qCritical("No bgfx view left for a BgfxItem (%u per item), it won't be rendered", unsigned(ViewCount));
+            return;
+        }
+        bgfxGlobal.registerRenderer(this);
 
-        bgfx::createFrameBuffer((void*)wid, m_viewportSize.width(), m_viewportSize.height());
+        if (bgfxGlobal.rendersOffscreen())
+        {
+            // In WorkerThread mode the window belongs to Qt's render thread
+            if (bgfxGlobal.m_threadingMode != ThreadingMode::WorkerThread)
+                bgfx::createFrameBuffer((void*)wid, m_viewportSize.width(), m_viewportSize.height());
 
-        resizeOffscreenFB();
-        bgfx::setViewFrameBuffer(0, offscreenFB);
-    }
+            resizeOffscreenFB();
+        }
 
-    resize();
+        resize_Backend();
 
-    // Create example resources
-    bgfxExample.init();
+        // Create example resources
+        bgfxExample.init(m_viewId);
+    });
 }
 
 #include "bgfxItem.moc"
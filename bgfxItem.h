@@ -1,8 +1,13 @@
 #pragma once
+#include <QtCore/QTimer>
+#include <QtCore/QUrl>
 #include <QtQuick/QQuickItem>
 #include <QtQuick/QSGRendererInterface>
 
+#include <memory>
+
 class bgfxRenderer;
+class QImage;
 
 struct InteropMode
 {
@@ -11,24 +16,242 @@ struct InteropMode
         ExternPlatform,             // Use platformData to set backBuffer
         SynchroFramebuffer,         // Create a bgfx::Framebuffer synchronized with extern Texture handle given by Qt
         OffscreenFramebuffer,       // Create a bgfx::Framebuffer, render to it, then blit result
+        TextureNode,                // Create a bgfx::Framebuffer, render to it, then let the scene graph sample it (zero-copy)
+        TextureAtlas,               // Same as TextureNode, every item renders its own size into a region of render targets shared by all items
+        Count
+    };
+};
+
+struct ThreadingMode
+{
+    enum Enum
+    {
+        SingleThread,               // bgfx API calls and rendering both run on Qt's render thread
+        MultiThread,                // bgfx API calls run on a worker thread, Qt's render thread calls bgfx::renderFrame() (OffscreenFramebuffer/TextureNode/TextureAtlas only)
+        WorkerThread,               // bgfx API calls and rendering both run on a worker thread with its own GL context shared with Qt's, windows only composite:
+                                    // required by Qt's threaded render loop, one render thread per window (OffscreenFramebuffer/TextureNode/TextureAtlas, OpenGL or Noop only)
         Count
     };
 };
 
 // Initialize BGFX
-bool InitQt_BGFX_Backend(QSGRendererInterface::GraphicsApi pbackend, InteropMode::Enum pInteropMode );
+// QSGRendererInterface::Software selects Qt software scene graph with the bgfx Noop renderer (no GPU, benchmarks)
+// Must be called before the first window is created: QSG_RENDER_LOOP is set to basic unless pThreadingMode is WorkerThread
+// pMaxInstancedGrid is the largest instanced cube grid drawn by an item (e.g. 1000 for 1000x1000), bgfx's transient
+// buffer is grown to hold its instance data. 0 keeps bgfx's default, enough for ~300x300.
+bool InitQt_BGFX_Backend(QSGRendererInterface::GraphicsApi pbackend, InteropMode::Enum pInteropMode, ThreadingMode::Enum pThreadingMode = ThreadingMode::SingleThread, int pMaxInstancedGrid = 0);
 void FinalizeQt_BGFX_Backend();
 
+// Number of allocations made through the bgfx allocator since startup
+uint64_t BgfxAllocationCount();
+
+// Frame timings of a BgfxItem in milliseconds, over a rolling window of frames
+struct BgfxFrameStats
+{
+    Q_GADGET
+    Q_PROPERTY(float recordTime MEMBER recordTime)
+    Q_PROPERTY(float recordTimeP50 MEMBER recordTimeP50)
+    Q_PROPERTY(float recordTimeP95 MEMBER recordTimeP95)
+    Q_PROPERTY(float recordTimeP99 MEMBER recordTimeP99)
+    Q_PROPERTY(float frameTime MEMBER frameTime)
+    Q_PROPERTY(float frameTimeP50 MEMBER frameTimeP50)
+    Q_PROPERTY(float frameTimeP95 MEMBER frameTimeP95)
+    Q_PROPERTY(float frameTimeP99 MEMBER frameTimeP99)
+    Q_PROPERTY(float gpuTime MEMBER gpuTime)
+    Q_PROPERTY(float gpuTimeP50 MEMBER gpuTimeP50)
+    Q_PROPERTY(float gpuTimeP95 MEMBER gpuTimeP95)
+    Q_PROPERTY(float gpuTimeP99 MEMBER gpuTimeP99)
+    Q_PROPERTY(float waitRenderTime MEMBER waitRenderTime)
+    Q_PROPERTY(float waitSubmitTime MEMBER waitSubmitTime)
+    Q_PROPERTY(int drawCalls MEMBER drawCalls)
+
+public:
+    float recordTime = 0.f;     // CPU time recording the item views
+    float recordTimeP50 = 0.f;
+    float recordTimeP95 = 0.f;
+    float recordTimeP99 = 0.f;
+    float frameTime = 0.f;      // CPU time in bgfx::frame()
+    float frameTimeP50 = 0.f;
+    float frameTimeP95 = 0.f;
+    float frameTimeP99 = 0.f;
+    float gpuTime = 0.f;
+    float gpuTimeP50 = 0.f;
+    float gpuTimeP95 = 0.f;
+    float gpuTimeP99 = 0.f;
+    float waitRenderTime = 0.f; // API thread waiting for the render thread
+    float waitSubmitTime = 0.f; // render thread waiting for the API thread
+    int drawCalls = 0;          // whole bgfx frame, all items
+};
+Q_DECLARE_METATYPE(BgfxFrameStats)
+
+// Receives the frames captured from a BgfxItem, see BgfxItem::setCaptureSink()
+class BgfxCaptureSink
+{
+public:
+    virtual ~BgfxCaptureSink() = default;
+
+    // Called on a capture thread in frame order, a few frames after the frame was rendered.
+    // pImage (RGBA8888, top-down) wraps a pooled buffer: only valid during the call, copy it to keep it.
+    // pFrame increases with the bgfx frames, gaps are frames dropped because every buffer was busy
+    // or rendered for other items.
+    virtual void frameCaptured(const QImage& pImage, uint32_t pFrame) = 0;
+};
+
 class BgfxItem : public QQuickItem
 {
     Q_OBJECT
     //Q_PROPERTY(qreal t READ t WRITE setT NOTIFY tChanged)
+    Q_PROPERTY(int gridSize READ gridSize WRITE setGridSize NOTIFY gridSizeChanged)
+    Q_PROPERTY(bool instanced READ instanced WRITE setInstanced NOTIFY instancedChanged)
+    Q_PROPERTY(bool occlusionCulling READ occlusionCulling WRITE setOcclusionCulling NOTIFY occlusionCullingChanged)
+    Q_PROPERTY(RenderPolicy renderPolicy READ renderPolicy WRITE setRenderPolicy NOTIFY renderPolicyChanged)
+    Q_PROPERTY(int fixedRate READ fixedRate WRITE setFixedRate NOTIFY fixedRateChanged)
+    Q_PROPERTY(FramePacing framePacing READ framePacing WRITE setFramePacing NOTIFY framePacingChanged)
+    Q_PROPERTY(int samples READ samples WRITE setSamples NOTIFY samplesChanged)
+    Q_PROPERTY(ColorFormat colorFormat READ colorFormat WRITE setColorFormat NOTIFY colorFormatChanged)
+    Q_PROPERTY(DepthFormat depthFormat READ depthFormat WRITE setDepthFormat NOTIFY depthFormatChanged)
+    Q_PROPERTY(bool depthWriteOnly READ depthWriteOnly WRITE setDepthWriteOnly NOTIFY depthWriteOnlyChanged)
+    Q_PROPERTY(float targetFrameTime READ targetFrameTime WRITE setTargetFrameTime NOTIFY targetFrameTimeChanged)
+    Q_PROPERTY(float minRenderScale READ minRenderScale WRITE setMinRenderScale NOTIFY minRenderScaleChanged)
+    Q_PROPERTY(float maxRenderScale READ maxRenderScale WRITE setMaxRenderScale NOTIFY maxRenderScaleChanged)
+    Q_PROPERTY(float renderScale READ renderScale NOTIFY renderScaleChanged)
+    Q_PROPERTY(QUrl background READ background WRITE setBackground NOTIFY backgroundChanged)
+    Q_PROPERTY(BgfxFrameStats stats READ stats NOTIFY statsChanged)
+    Q_PROPERTY(QString statsFile READ statsFile WRITE setStatsFile NOTIFY statsFileChanged)
+    Q_PROPERTY(QString captureFile READ captureFile WRITE setCaptureFile NOTIFY captureFileChanged)
 
 public:
+    enum RenderPolicy
+    {
+        Continuous,                 // Render a new bgfx frame every time the window is rendered, and keep the window updating
+        OnDemand,                   // Render a new bgfx frame only after invalidate() or a change, else reuse the last one
+        FixedRate                   // Same as OnDemand, plus invalidate() fixedRate times per second
+    };
+    Q_ENUM(RenderPolicy)
+
+    // Offscreen InteropModes only
+    enum FramePacing
+    {
+        LowLatency,                 // Render into a single target, composited in the same frame (Qt waits for bgfx). ThreadingMode::WorkerThread always uses the ring
+        Throughput                  // Render into a ring of 3 targets, Qt composites the newest one the GPU completed while bgfx renders the next
+    };
+    Q_ENUM(FramePacing)
+
+    // Offscreen render target formats (offscreen InteropModes only). Formats the GPU can't
+    // render to fall back to RGBA8 and D24S8
+    enum ColorFormat
+    {
+        RGBA8,
+        RGB10A2,                    // OpenGL only, Direct3D11 copies and samples the target as RGBA8
+        RGBA16F                     // OpenGL only, same
+    };
+    Q_ENUM(ColorFormat)
+
+    enum DepthFormat
+    {
+        D24S8,
+        D16,
+        D32F
+    };
+    Q_ENUM(DepthFormat)
+
     BgfxItem();
 
+    // Cubes per side of the example grid (default 11x11)
+    int gridSize() const { return mGridSize; }
+    void setGridSize(int pGridSize);
+
+    // Draw the example grid with hardware instancing
+    bool instanced() const { return mInstanced; }
+    void setInstanced(bool pInstanced);
+
+    // Also cull the instanced grid against a hierarchical Z map on the GPU, with an indirect
+    // draw. Needs compute and indirect draw support, ignored without instanced.
+    bool occlusionCulling() const { return mOcclusionCulling; }
+    void setOcclusionCulling(bool pOcclusionCulling);
+
+    RenderPolicy renderPolicy() const { return mRenderPolicy; }
+    void setRenderPolicy(RenderPolicy pRenderPolicy);
+
+    // Frames per second in FixedRate policy
+    int fixedRate() const { return mFixedRate; }
+    void setFixedRate(int pFixedRate);
+
+    FramePacing framePacing() const { return mFramePacing; }
+    void setFramePacing(FramePacing pFramePacing);
+
+    // MSAA samples of the offscreen target: 1, 2, 4, 8 or 16, lowered to what the GPU supports.
+    // bgfx resolves the color once per frame into the texture Qt copies or samples
+    int samples() const { return mSamples; }
+    void setSamples(int pSamples);
+
+    ColorFormat colorFormat() const { return mColorFormat; }
+    void setColorFormat(ColorFormat pColorFormat);
+
+    DepthFormat depthFormat() const { return mDepthFormat; }
+    void setDepthFormat(DepthFormat pDepthFormat);
+
+    // Depth never sampled nor resolved (BGFX_TEXTURE_RT_WRITE_ONLY): a render buffer that
+    // tilers can keep in tile memory
+    bool depthWriteOnly() const { return mDepthWriteOnly; }
+    void setDepthWriteOnly(bool pDepthWriteOnly);
+
+    // Dynamic resolution: if targetFrameTime (ms) is set, the item renders at a fraction of its size
+    // adjusted to keep the bgfx GPU frame time under it, upscaled when composited.
+    // Offscreen InteropModes only, except OffscreenFramebuffer with Direct3D11 (the copy can't scale)
+    float targetFrameTime() const { return mTargetFrameTime; }
+    void setTargetFrameTime(float pTargetFrameTime);
+
+    // Bounds of the render scale, in [0.25, 1]
+    float minRenderScale() const { return mMinRenderScale; }
+    void setMinRenderScale(float pMinRenderScale);
+    float maxRenderScale() const { return mMaxRenderScale; }
+    void setMaxRenderScale(float pMaxRenderScale);
+
+    // Current render scale, 1 without dynamic resolution
+    float renderScale() const { return mRenderScale; }
+
+    // Image drawn behind the example grid, loaded asynchronously
+    QUrl background() const { return mBackground; }
+    void setBackground(const QUrl& pBackground);
+
+    // Request a new bgfx frame (OnDemand/FixedRate)
+    Q_INVOKABLE void invalidate();
+
+    BgfxFrameStats stats() const { return mStats; }
+
+    // If set, the frame timings history is written there when the item is released (.csv or .json)
+    QString statsFile() const { return mStatsFile; }
+    void setStatsFile(const QString& pStatsFile);
+
+    // Read every recorded frame back to pSink without stalling (OffscreenFramebuffer/TextureNode only), null stops
+    std::shared_ptr<BgfxCaptureSink> captureSink() const { return mCaptureSink; }
+    void setCaptureSink(std::shared_ptr<BgfxCaptureSink> pSink);
+
+    // If set, the captured frames are written there as a raw YUV4MPEG2 video (.y4m)
+    QString captureFile() const { return mCaptureFile; }
+    void setCaptureFile(const QString& pCaptureFile);
+
 signals:
     void tChanged();
+    void gridSizeChanged();
+    void instancedChanged();
+    void occlusionCullingChanged();
+    void renderPolicyChanged();
+    void fixedRateChanged();
+    void framePacingChanged();
+    void samplesChanged();
+    void colorFormatChanged();
+    void depthFormatChanged();
+    void depthWriteOnlyChanged();
+    void targetFrameTimeChanged();
+    void minRenderScaleChanged();
+    void maxRenderScaleChanged();
+    void renderScaleChanged();
+    void backgroundChanged();
+    void statsChanged();
+    void statsFileChanged();
+    void captureFileChanged();
 
 public slots:
     void sync();
@@ -40,5 +263,28 @@ private slots:
 private:
     virtual QSGNode* updatePaintNode(QSGNode* node, UpdatePaintNodeData*);
     void releaseResources() override;
+    void updateFixedRateTimer();
     bgfxRenderer *mRenderer = nullptr;
+    int mGridSize = 11;
+    bool mInstanced = false;
+    bool mOcclusionCulling = false;
+    RenderPolicy mRenderPolicy = Continuous;
+    int mFixedRate = 30;
+    FramePacing mFramePacing = LowLatency;
+    int mSamples = 1;
+    ColorFormat mColorFormat = RGBA8;
+    DepthFormat mDepthFormat = D24S8;
+    bool mDepthWriteOnly = false;
+    float mTargetFrameTime = 0.f;
+    float mMinRenderScale = 0.5f;
+    float mMaxRenderScale = 1.f;
+    float mRenderScale = 1.f;   // copied from the renderer in sync()
+    QTimer mFixedRateTimer;
+    QUrl mBackground;
+    QString mBackgroundPath; // mBackground as a QFile path
+    bool mDirty = true;     // GUI thread, given to the renderer in sync()
+    BgfxFrameStats mStats;  // copied from the renderer in sync()
+    QString mStatsFile;
+    std::shared_ptr<BgfxCaptureSink> mCaptureSink;
+    QString mCaptureFile;
 };
\ No newline at end of file
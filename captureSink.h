@@ -0,0 +1,95 @@
+#pragma once
+#include <QtCore/QFile>
+#include <QtGui/QImage>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "bgfxItem.h"
+
+/******************************************************************************/
+// Capture sink writing a raw YUV4MPEG2 video (4:2:0, BT.601 limited range), played
+// or encoded as is by ffmpeg/mpv. The video size is the one of the first frame, later
+// frames of another size (window resized) are scaled to it.
+// Planes are converted into buffers kept between frames, no allocation per frame.
+class Y4MCaptureSink : public BgfxCaptureSink
+{
+public:
+    Y4MCaptureSink(const QString& pPath, int pFrameRate) : m_file(pPath), m_frameRate(pFrameRate) { }
+
+    void frameCaptured(const QImage& pImage, uint32_t) override
+    {
+        if (m_failed)
+            return;
+
+        if (!m_file.isOpen())
+        {
+            m_size = pImage.size();
+            const QByteArray header = QString("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C420jpeg\n")
+                .arg(m_size.width()).arg(m_size.height()).arg(m_frameRate).toLatin1();
+            if (!m_file.open(QIODevice::WriteOnly) || m_file.write(header) != header.size())
+            {
+                qWarning("Can't write %s", qPrintable(m_file.fileName()));
+                m_failed = true;
+                return;
+            }
+        }
+
+        if (pImage.size() == m_size)
+            convert(pImage);
+        else
+            convert(pImage.scaled(m_size).convertToFormat(QImage::Format_RGBA8888));
+
+        if (m_file.write("FRAME\n", 6) != 6
+            || m_file.write(reinterpret_cast<const char*>(m_planes.data()), qint64(m_planes.size())) != qint64(m_planes.size()))
+        {
+            qWarning("Can't write %s", qPrintable(m_file.fileName()));
+            m_failed = true;
+        }
+    }
+
+private:
+    // RGBA8888 to Y, U and V planes, chroma averaged over 2x2 pixels
+    void convert(const QImage& pImage)
+    {
+        const int width = m_size.width();
+        const int height = m_size.height();
+        const int chromaWidth = (width + 1) / 2;
+        const int chromaHeight = (height + 1) / 2;
+        m_planes.resize(size_t(width) * height + 2 * size_t(chromaWidth) * chromaHeight);
+        uint8_t* yPlane = m_planes.data();
+        uint8_t* uPlane = yPlane + size_t(width) * height;
+        uint8_t* vPlane = uPlane + size_t(chromaWidth) * chromaHeight;
+
+        for (int yy = 0; yy < height; ++yy)
+        {
+            const uint8_t* rgba = pImage.constScanLine(yy);
+            uint8_t* luma = yPlane + size_t(yy) * width;
+            for (int xx = 0; xx < width; ++xx, rgba += 4)
+                luma[xx] = uint8_t(((66 * rgba[0] + 129 * rgba[1] + 25 * rgba[2] + 128) >> 8) + 16);
+        }
+
+        for (int cy = 0; cy < chromaHeight; ++cy)
+        {
+            const uint8_t* row0 = pImage.constScanLine(2 * cy);
+            const uint8_t* row1 = pImage.constScanLine(std::min(2 * cy + 1, height - 1));
+            for (int cx = 0; cx < chromaWidth; ++cx)
+            {
+                const int x0 = 2 * cx * 4;
+                const int x1 = std::min(2 * cx + 1, width - 1) * 4;
+                const int rr = (row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2;
+                const int gg = (row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1] + 2) >> 2;
+                const int bb = (row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2] + 2) >> 2;
+                uPlane[size_t(cy) * chromaWidth + cx] = uint8_t(((-38 * rr - 74 * gg + 112 * bb + 128) >> 8) + 128);
+                vPlane[size_t(cy) * chromaWidth + cx] = uint8_t(((112 * rr - 94 * gg - 18 * bb + 128) >> 8) + 128);
+            }
+        }
+    }
+
+    QFile m_file;
+    int m_frameRate;
+    QSize m_size;
+    bool m_failed = false;
+    std::vector<uint8_t> m_planes;  // Y, U then V, as written
+};
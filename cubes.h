@@ -5,81 +5,87 @@
 
 #   include <bgfx/bgfx.h>
 #   include <bgfx/platform.h>
-#   include <bx/file.h>
 #   include <bx/allocator.h>
 #   include <bx/timer.h>
 
+#   include "culling.h"
+#   include "transforms.h"
+
 namespace
 {
 
-	static bx::FileReaderI* s_fileReader = NULL;
+struct PosColorVertex
+{
+	float m_x;
+	float m_y;
+	float m_z;
+	uint32_t m_abgr;
 
-	static const bgfx::Memory* loadMem(bx::FileReaderI* _reader, const char* _filePath)
+	static void init()
 	{
-		if (bx::open(_reader, _filePath))
-		{
-			uint32_t size = (uint32_t)bx::getSize(_reader);
-			const bgfx::Memory* mem = bgfx::alloc(size + 1);
-			bx::read(_reader, mem->data, size);
-			bx::close(_reader);
-			mem->data[mem->size - 1] = '\0';
-			return mem;
-		}
-		return NULL;
-	}
+		ms_layout
+			.begin()
+			.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::Color0,   4, bgfx::AttribType::Uint8, true)
+			.end();
+	};
 
-	bgfx::ShaderHandle loadShader(bx::FileReaderI* _reader, const char* _name)
-	{
-		bgfx::ShaderHandle handle = bgfx::createShader(loadMem(_reader, _name));
-		bgfx::setName(handle, _name);
+	static bgfx::VertexLayout ms_layout;
+};
 
-		return handle;
-	}
+bgfx::VertexLayout PosColorVertex::ms_layout;
 
-	bgfx::ShaderHandle loadShader(const char* _name)
-	{
-		return loadShader(s_fileReader, _name);
-	}
+struct PosTexVertex
+{
+	float m_x;
+	float m_y;
+	float m_z;
+	float m_u;
+	float m_v;
 
-	bgfx::ProgramHandle loadProgram(bx::FileReaderI* _reader, const char* _vsName, const char* _fsName)
+	static void init()
 	{
-		bgfx::ShaderHandle vsh = loadShader(_reader, _vsName);
-		bgfx::ShaderHandle fsh = BGFX_INVALID_HANDLE;
-		if (NULL != _fsName)
-		{
-			fsh = loadShader(_reader, _fsName);
-		}
+		ms_layout
+			.begin()
+			.add(bgfx::Attrib::Position,  3, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
+			.end();
+	};
 
-		return bgfx::createProgram(vsh, fsh, true);
-	}
+	static bgfx::VertexLayout ms_layout;
+};
 
-	bgfx::ProgramHandle loadProgram(const char* _vsName, const char* _fsName)
-	{
-		if (!s_fileReader)
-			s_fileReader = new bx::FileReader();
-		return loadProgram(s_fileReader, _vsName, _fsName);
-	}
+bgfx::VertexLayout PosTexVertex::ms_layout;
 
-struct PosColorVertex
+// Model matrix per cube, instance data of the occlusion culled draw.
+struct InstanceMatrix
 {
-	float m_x;
-	float m_y;
-	float m_z;
-	uint32_t m_abgr;
+	float m_col[16];
 
 	static void init()
 	{
 		ms_layout
 			.begin()
-			.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::Color0,   4, bgfx::AttribType::Uint8, true)
+			.add(bgfx::Attrib::TexCoord7, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord6, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord5, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord4, 4, bgfx::AttribType::Float)
 			.end();
 	};
 
 	static bgfx::VertexLayout ms_layout;
 };
 
-bgfx::VertexLayout PosColorVertex::ms_layout;
+bgfx::VertexLayout InstanceMatrix::ms_layout;
+
+// Full screen quad (triangle strip) in clip space, for the background image.
+static PosTexVertex s_backgroundVertices[] =
+{
+	{-1.0f,  1.0f,  1.0f, 0.0f, 0.0f },
+	{ 1.0f,  1.0f,  1.0f, 1.0f, 0.0f },
+	{-1.0f, -1.0f,  1.0f, 0.0f, 1.0f },
+	{ 1.0f, -1.0f,  1.0f, 1.0f, 1.0f },
+};
 
 static PosColorVertex s_cubeVertices[] =
 {
@@ -172,21 +178,64 @@ static const uint64_t s_ptState[]
 };
 BX_STATIC_ASSERT(BX_COUNTOF(s_ptState) == BX_COUNTOF(s_ptNames) );
 
+static const uint32_t s_ptNumIndices[]
+{
+	BX_COUNTOF(s_cubeTriList),
+	BX_COUNTOF(s_cubeTriStrip),
+	BX_COUNTOF(s_cubeLineList),
+	BX_COUNTOF(s_cubeLineStrip),
+	BX_COUNTOF(s_cubePoints),
+};
+BX_STATIC_ASSERT(BX_COUNTOF(s_ptNumIndices) == BX_COUNTOF(s_ptNames) );
+
 class ExampleCubes
 {
 public:
 	ExampleCubes()
+		: m_x(0)
+		, m_y(0)
+		, m_background(BGFX_INVALID_HANDLE)
+		, m_grid(11)
+		, m_instanced(false)
+		, m_occlusionCulling(false)
+		, m_occlusionSupported(false)
+		, m_hizDepth(BGFX_INVALID_HANDLE)
+		, m_hizFb(BGFX_INVALID_HANDLE)
+		, m_hiz(BGFX_INVALID_HANDLE)
+		, m_instanceInput(BGFX_INVALID_HANDLE)
+		, m_instanceOutput(BGFX_INVALID_HANDLE)
+		, m_instanceCapacity(0)
+		, m_drawCount(BGFX_INVALID_HANDLE)
+		, m_drawArgs(BGFX_INVALID_HANDLE)
+		, m_dropped(0)
+		, m_droppedWarned(false)
 	{
 	}
 
+	// Number of bgfx views used by the example, starting at the view given to init():
+	// the example view, then the occluder depth and the culling compute views, which
+	// are executed before it.
+	static const uint16_t ViewCount = 3;
+
+	// Occluder depth buffer and hierarchical Z map size, and its mip count.
+	static const uint16_t s_hizSize = 256;
+	static const uint8_t  s_hizMips = 9;
+
+	// Below this many cubes per chunk, recording in parallel costs more than it saves.
+	static const uint32_t s_minCubesPerJob = 4096;
+
+	// Model matrices allocated at once from the bgfx transform cache.
+	static const uint32_t s_transformsPerAlloc = 1024;
+
 	// Create resources
-	void init()
+	void init(bgfx::ViewId _viewId)
 	{
+		m_viewId = _viewId;
 		m_r = m_b = m_g = m_a = true;
 		m_reset = BGFX_RESET_NONE;
 
-		// Set view 0 clear state.
-		bgfx::setViewClear(0
+		// Set view clear state.
+		bgfx::setViewClear(m_viewId
 			, BGFX_CLEAR_COLOR|BGFX_CLEAR_DEPTH
 			, 0x303030ff
 			, 1.0f
@@ -195,55 +244,78 @@ public:
 
 		// Create vertex stream declaration.
 		PosColorVertex::init();
+		PosTexVertex::init();
 
-		// Create static vertex buffer.
-		m_vbh = bgfx::createVertexBuffer(
-			// Static data can be passed with bgfx::makeRef
-			  bgfx::makeRef(s_cubeVertices, sizeof(s_cubeVertices) )
-			, PosColorVertex::ms_layout
-			);
-
-		// Create static index buffer for triangle list rendering.
-		m_ibh[0] = bgfx::createIndexBuffer(
-			// Static data can be passed with bgfx::makeRef
-			bgfx::makeRef(s_cubeTriList, sizeof(s_cubeTriList) )
-			);
+		// Create static vertex buffer. Static data is shared by every item through
+		// bgfxGlobal's resource cache.
+		m_vbh = bgfxGlobal.acquireVertexBuffer(s_cubeVertices, sizeof(s_cubeVertices), PosColorVertex::ms_layout);
 
-		// Create static index buffer for triangle strip rendering.
-		m_ibh[1] = bgfx::createIndexBuffer(
-			// Static data can be passed with bgfx::makeRef
-			bgfx::makeRef(s_cubeTriStrip, sizeof(s_cubeTriStrip) )
-			);
+		// Create static vertex buffer for the background quad.
+		m_backgroundVbh = bgfxGlobal.acquireVertexBuffer(s_backgroundVertices, sizeof(s_backgroundVertices), PosTexVertex::ms_layout);
 
-		// Create static index buffer for line list rendering.
-		m_ibh[2] = bgfx::createIndexBuffer(
-			// Static data can be passed with bgfx::makeRef
-			bgfx::makeRef(s_cubeLineList, sizeof(s_cubeLineList) )
-			);
+		// Create static index buffers for triangle list, triangle strip, line list,
+		// line strip and point list rendering.
+		m_ibh[0] = bgfxGlobal.acquireIndexBuffer(s_cubeTriList, sizeof(s_cubeTriList) );
+		m_ibh[1] = bgfxGlobal.acquireIndexBuffer(s_cubeTriStrip, sizeof(s_cubeTriStrip) );
+		m_ibh[2] = bgfxGlobal.acquireIndexBuffer(s_cubeLineList, sizeof(s_cubeLineList) );
+		m_ibh[3] = bgfxGlobal.acquireIndexBuffer(s_cubeLineStrip, sizeof(s_cubeLineStrip) );
+		m_ibh[4] = bgfxGlobal.acquireIndexBuffer(s_cubePoints, sizeof(s_cubePoints) );
 
-		// Create static index buffer for line strip rendering.
-		m_ibh[3] = bgfx::createIndexBuffer(
-			// Static data can be passed with bgfx::makeRef
-			bgfx::makeRef(s_cubeLineStrip, sizeof(s_cubeLineStrip) )
-			);
+		// Create program from shaders, embedded at build time and shared by every item.
+		m_program = bgfxGlobal.acquireProgram("cubes.vert", "cubes.frag");
 
-		// Create static index buffer for point list rendering.
-		m_ibh[4] = bgfx::createIndexBuffer(
-			// Static data can be passed with bgfx::makeRef
-			bgfx::makeRef(s_cubePoints, sizeof(s_cubePoints) )
-			);
+		// Instanced variant, only if the renderer supports it.
+		m_programInstanced = BGFX_INVALID_HANDLE;
+		if (0 != (bgfx::getCaps()->supported & BGFX_CAPS_INSTANCING) )
+		{
+			m_programInstanced = bgfxGlobal.acquireProgram("cubes_instanced.vert", "cubes.frag");
+		}
 
-		// Create program from shaders.
-		#define SHADER_PATH "E:\\tmp\\proto-qt-bgfx\\d3d11underqml\\"
-		if (bgfxGlobal.m_backend == bgfx::RendererType::Direct3D11)
+		// GPU occlusion culling of the instanced grid, only if the renderer has compute
+		// shaders and indirect draws.
+		const uint64_t occlusionCaps = BGFX_CAPS_COMPUTE | BGFX_CAPS_DRAW_INDIRECT | BGFX_CAPS_INSTANCING;
+		m_programHizCopy = m_programHizDownscale = m_programOcclude = m_programIndirect = BGFX_INVALID_HANDLE;
+		if (occlusionCaps == (bgfx::getCaps()->supported & occlusionCaps)
+		&&  bgfx::isTextureValid(0, false, 1, bgfx::TextureFormat::D32F, BGFX_TEXTURE_RT)
+		&&  bgfx::isTextureValid(0, false, 1, bgfx::TextureFormat::R32F, BGFX_TEXTURE_COMPUTE_WRITE) )
 		{
-			m_program = loadProgram(SHADER_PATH "bin\\dx11\\cubes.vert.bin", SHADER_PATH "bin\\dx11\\cubes.frag.bin");
+			InstanceMatrix::init();
+			m_programHizCopy      = bgfxGlobal.acquireComputeProgram("hiz_copy.comp");
+			m_programHizDownscale = bgfxGlobal.acquireComputeProgram("hiz_downscale.comp");
+			m_programOcclude      = bgfxGlobal.acquireComputeProgram("cubes_occlude.comp");
+			m_programIndirect     = bgfxGlobal.acquireComputeProgram("cubes_indirect.comp");
 		}
-		else
+		m_occlusionSupported = bgfx::isValid(m_programInstanced)
+			&& bgfx::isValid(m_programHizCopy)
+			&& bgfx::isValid(m_programHizDownscale)
+			&& bgfx::isValid(m_programOcclude)
+			&& bgfx::isValid(m_programIndirect)
+			;
+		if (m_occlusionSupported)
 		{
-			m_program = loadProgram(SHADER_PATH "bin\\glsl\\cubes.vert.bin", SHADER_PATH "bin\\glsl\\cubes.frag.bin");
+			s_hizDepth     = bgfx::createUniform("s_hizDepth",     bgfx::UniformType::Sampler);
+			s_hiz          = bgfx::createUniform("s_hiz",          bgfx::UniformType::Sampler);
+			u_hizParams    = bgfx::createUniform("u_hizParams",    bgfx::UniformType::Vec4);
+			u_cullViewProj = bgfx::createUniform("u_cullViewProj", bgfx::UniformType::Mat4);
+			u_cullParams   = bgfx::createUniform("u_cullParams",   bgfx::UniformType::Vec4);
+			u_cullDepth    = bgfx::createUniform("u_cullDepth",    bgfx::UniformType::Vec4);
+			u_drawParams   = bgfx::createUniform("u_drawParams",   bgfx::UniformType::Vec4);
 		}
-		
+
+		// Occluder depth and culling passes first, in the example's own view range.
+		const bgfx::ViewId order[ViewCount] =
+		{
+			bgfx::ViewId(m_viewId + 1),
+			bgfx::ViewId(m_viewId + 2),
+			m_viewId,
+		};
+		bgfx::setViewOrder(m_viewId, ViewCount, order);
+
+		// Background image, the texture is streamed in by the renderer (setBackground).
+		m_backgroundProgram = bgfxGlobal.acquireProgram("background.vert", "background.frag");
+		s_texColor = bgfx::createUniform("s_texColor", bgfx::UniformType::Sampler);
+		u_texLod   = bgfx::createUniform("u_texLod",   bgfx::UniformType::Vec4);
+
 		m_timeOffset = bx::getHPCounter();
 		m_pt = 0;
 		/*
@@ -257,14 +329,37 @@ public:
 		imguiDestroy();
 		*/
 
-		// Cleanup.
+		// Cleanup, shared resources are destroyed with their last reference.
 		for (uint32_t ii = 0; ii < BX_COUNTOF(m_ibh); ++ii)
 		{
-			bgfx::destroy(m_ibh[ii]);
+			bgfxGlobal.release(m_ibh[ii]);
 		}
 
-		bgfx::destroy(m_vbh);
-		bgfx::destroy(m_program);
+		bgfxGlobal.release(m_vbh);
+		bgfxGlobal.release(m_backgroundVbh);
+		bgfxGlobal.release(m_program);
+		bgfxGlobal.release(m_programInstanced);
+		bgfxGlobal.release(m_backgroundProgram);
+		bgfx::destroy(s_texColor);
+		bgfx::destroy(u_texLod);
+		m_background = BGFX_INVALID_HANDLE;
+
+		bgfxGlobal.release(m_programHizCopy);
+		bgfxGlobal.release(m_programHizDownscale);
+		bgfxGlobal.release(m_programOcclude);
+		bgfxGlobal.release(m_programIndirect);
+		if (m_occlusionSupported)
+		{
+			bgfx::destroy(s_hizDepth);
+			bgfx::destroy(s_hiz);
+			bgfx::destroy(u_hizParams);
+			bgfx::destroy(u_cullViewProj);
+			bgfx::destroy(u_cullParams);
+			bgfx::destroy(u_cullDepth);
+			bgfx::destroy(u_drawParams);
+		}
+		destroyOcclusionBuffers();
+		bgfx::setViewOrder(m_viewId, ViewCount);
 
 		// Shutdown bgfx.
 		//bgfx::shutdown();
@@ -278,7 +373,323 @@ public:
 		m_height = _height;
 	}
 
-	bool update()
+	// Top-left corner of the view in its framebuffer, not 0 in a texture atlas region.
+	void setOrigin(uint32_t _x, uint32_t _y)
+	{
+		m_x = _x;
+		m_y = _y;
+	}
+
+	// Texture drawn behind the grid, owned by the renderer's TextureStream. Invalid for none.
+	// _lod is TextureStream::lod(): finest resident mip and texture size.
+	void setBackground(bgfx::TextureHandle _texture, const float* _lod)
+	{
+		m_background = _texture;
+		if (NULL != _lod)
+		{
+			bx::memCopy(m_backgroundLod, _lod, sizeof(m_backgroundLod) );
+		}
+	}
+
+	// Number of cubes per grid side (grid is _grid x _grid cubes).
+	void setGridSize(uint32_t _grid)
+	{
+		m_grid = bx::max<uint32_t>(_grid, 1);
+		m_droppedWarned = false;
+	}
+
+	// Per cube transform (position and rotation phase) and bounding sphere, a cube
+	// rotates inside the sphere around its corners. Rebuilt when the grid size changes.
+	void updateGrid()
+	{
+		const uint32_t numCubes = m_grid*m_grid;
+		if (m_transforms.size() == numCubes)
+		{
+			return;
+		}
+
+		const float offset = -1.5f*float(m_grid - 1);
+		m_transforms.resize(numCubes);
+		m_bounds.resize(numCubes);
+		for (uint32_t ii = 0; ii < numCubes; ++ii)
+		{
+			const uint32_t xx = ii % m_grid;
+			const uint32_t yy = ii / m_grid;
+			m_transforms.x[ii] = m_bounds.x[ii] = offset + float(xx)*3.0f;
+			m_transforms.y[ii] = m_bounds.y[ii] = offset + float(yy)*3.0f;
+			m_transforms.z[ii] = m_bounds.z[ii] = 0.0f;
+			m_transforms.phaseX[ii] = xx*0.21f;
+			m_transforms.phaseY[ii] = yy*0.37f;
+			m_bounds.radius[ii] = bx::sqrt(3.0f);
+		}
+		m_cullMask.resize(numCubes);
+		m_visible.reserve(numCubes);
+	}
+
+	// Fill m_visible with the index of the cubes intersecting the view frustum.
+	void cull(const float* _view, const float* _proj)
+	{
+		updateGrid();
+
+		float viewProj[16];
+		bx::mtxMul(viewProj, _view, _proj);
+		Frustum frustum;
+		frustum.build(viewProj, bgfx::getCaps()->homogeneousDepth);
+
+		bgfxGlobal.parallelFor(m_bounds.size(), s_minCubesPerJob, [&](uint32_t _first, uint32_t _last)
+		{
+			m_bounds.cull(frustum, m_cullMask.data(), _first, _last);
+		});
+
+		m_visible.clear();
+		for (uint32_t ii = 0; ii < m_bounds.size(); ++ii)
+		{
+			if (0 != m_cullMask[ii])
+			{
+				m_visible.push_back(ii);
+			}
+		}
+	}
+
+	// Number of cubes submitted by the last update().
+	uint32_t numVisible() const
+	{
+		return uint32_t(m_visible.size() );
+	}
+
+	// Draw the whole grid with hardware instancing instead of one submit per cube.
+	// Ignored if the renderer doesn't support instancing.
+	void setInstanced(bool _instanced)
+	{
+		m_instanced = _instanced;
+		m_droppedWarned = false;
+	}
+
+	bool isInstanced() const
+	{
+		return m_instanced && bgfx::isValid(m_programInstanced);
+	}
+
+	// Cull the instanced grid against a hierarchical Z map on the GPU as well.
+	// Ignored if the renderer doesn't support compute shaders and indirect draws.
+	void setOcclusionCulling(bool _occlusionCulling)
+	{
+		if (_occlusionCulling && !m_occlusionCulling && !m_occlusionSupported)
+		{
+			qWarning("GPU occlusion culling isn't supported by the %s renderer, the cubes are only frustum culled"
+				, bgfx::getRendererName(bgfx::getRendererType() ) );
+		}
+		m_occlusionCulling = _occlusionCulling;
+	}
+
+	bool isOcclusionCulled() const
+	{
+		return isInstanced() && m_occlusionCulling && m_occlusionSupported;
+	}
+
+	// Occluder depth buffer, hierarchical Z map and draw counters are created on first
+	// use, the instance buffers hold the whole grid and follow its size.
+	void createOcclusionBuffers(uint32_t _numCubes)
+	{
+		if (!bgfx::isValid(m_hiz) )
+		{
+			m_hizDepth = bgfx::createTexture2D(s_hizSize, s_hizSize, false, 1, bgfx::TextureFormat::D32F, BGFX_TEXTURE_RT);
+			m_hizFb = bgfx::createFrameBuffer(1, &m_hizDepth, false);
+			m_hiz = bgfx::createTexture2D(s_hizSize, s_hizSize, true, 1, bgfx::TextureFormat::R32F, BGFX_TEXTURE_COMPUTE_WRITE);
+
+			const uint32_t zero = 0;
+			m_drawCount = bgfx::createDynamicIndexBuffer(bgfx::copy(&zero, sizeof(zero) ), BGFX_BUFFER_INDEX32|BGFX_BUFFER_COMPUTE_READ_WRITE);
+			m_drawArgs = bgfx::createIndirectBuffer(1);
+		}
+
+		if (m_instanceCapacity != _numCubes)
+		{
+			if (bgfx::isValid(m_instanceInput) )
+			{
+				bgfx::destroy(m_instanceInput);
+				bgfx::destroy(m_instanceOutput);
+			}
+			m_instanceInput = bgfx::createDynamicVertexBuffer(_numCubes, InstanceMatrix::ms_layout, BGFX_BUFFER_COMPUTE_READ);
+			m_instanceOutput = bgfx::createDynamicVertexBuffer(_numCubes, InstanceMatrix::ms_layout, BGFX_BUFFER_COMPUTE_WRITE);
+			m_instanceCapacity = _numCubes;
+		}
+	}
+
+	void destroyOcclusionBuffers()
+	{
+		if (bgfx::isValid(m_hiz) )
+		{
+			bgfx::destroy(m_hizFb);
+			bgfx::destroy(m_hizDepth);
+			bgfx::destroy(m_hiz);
+			bgfx::destroy(m_drawCount);
+			bgfx::destroy(m_drawArgs);
+			m_hizFb = BGFX_INVALID_HANDLE;
+			m_hizDepth = BGFX_INVALID_HANDLE;
+			m_hiz = BGFX_INVALID_HANDLE;
+			m_drawCount = BGFX_INVALID_HANDLE;
+			m_drawArgs = BGFX_INVALID_HANDLE;
+		}
+
+		if (bgfx::isValid(m_instanceInput) )
+		{
+			bgfx::destroy(m_instanceInput);
+			bgfx::destroy(m_instanceOutput);
+			m_instanceInput = BGFX_INVALID_HANDLE;
+			m_instanceOutput = BGFX_INVALID_HANDLE;
+		}
+		m_instanceCapacity = 0;
+	}
+
+	// Submit the frustum visible cubes with a single indirect draw, after a GPU pass drops
+	// the ones hidden by others. The cubes are drawn to a small depth buffer, reduced to a
+	// hierarchical Z map of the farthest depths, against which a compute shader tests each
+	// cube's bounds, appends the matrices of the ones passing and writes the draw count.
+	void submitOcclusionCulled(bgfx::Encoder* _encoder, const float* _view, const float* _proj, uint64_t _state, bgfx::IndexBufferHandle _ibh, float _time)
+	{
+		const uint16_t instanceStride = 64; // 4x4 matrix
+		const uint32_t numInstances = numVisible();
+		if (0 == numInstances)
+		{
+			return;
+		}
+
+		createOcclusionBuffers(m_bounds.size() );
+
+		// Model matrices of the frustum visible cubes, read by both passes.
+		const bgfx::Memory* mem = bgfx::alloc(numInstances*instanceStride);
+		bgfxGlobal.parallelFor(numInstances, s_minCubesPerJob, [&](uint32_t _first, uint32_t _last)
+		{
+			m_transforms.compute(&m_visible[_first], _last - _first, _time, mem->data + _first*instanceStride, instanceStride);
+		});
+		bgfx::update(m_instanceInput, 0, mem);
+
+		// Occluder depth: the same cubes, depth only at the Hi-Z resolution.
+		const bgfx::ViewId occluderView = bgfx::ViewId(m_viewId + 1);
+		const bgfx::ViewId cullView     = bgfx::ViewId(m_viewId + 2);
+		bgfx::setViewFrameBuffer(occluderView, m_hizFb);
+		bgfx::setViewRect(occluderView, 0, 0, s_hizSize, s_hizSize);
+		bgfx::setViewClear(occluderView, BGFX_CLEAR_DEPTH, 0, 1.0f, 0);
+		bgfx::setViewTransform(occluderView, _view, _proj);
+
+		_encoder->setVertexBuffer(0, m_vbh);
+		_encoder->setIndexBuffer(m_ibh[0]);
+		_encoder->setInstanceDataBuffer(m_instanceInput, 0, numInstances);
+		_encoder->setState(0
+			| BGFX_STATE_WRITE_Z
+			| BGFX_STATE_DEPTH_TEST_LESS
+			| BGFX_STATE_CULL_CW
+			);
+		_encoder->submit(occluderView, m_programInstanced);
+
+		// Hierarchical Z: mip 0 is a copy of the depth, each next mip the farthest depth
+		// of 2x2 texels of the previous one.
+		float hizParams[4] = { float(s_hizSize), float(s_hizSize), 0.0f, 0.0f };
+		_encoder->setUniform(u_hizParams, hizParams);
+		_encoder->setTexture(0, s_hizDepth, m_hizDepth, BGFX_SAMPLER_POINT|BGFX_SAMPLER_UVW_CLAMP);
+		_encoder->setImage(1, m_hiz, 0, bgfx::Access::Write, bgfx::TextureFormat::R32F);
+		_encoder->dispatch(cullView, m_programHizCopy, s_hizSize/16, s_hizSize/16);
+
+		for (uint8_t lod = 1; lod < s_hizMips; ++lod)
+		{
+			const uint32_t size = s_hizSize >> lod;
+			hizParams[0] = hizParams[1] = float(size);
+			_encoder->setUniform(u_hizParams, hizParams);
+			_encoder->setImage(0, m_hiz, uint8_t(lod - 1), bgfx::Access::Read,  bgfx::TextureFormat::R32F);
+			_encoder->setImage(1, m_hiz, lod,     bgfx::Access::Write, bgfx::TextureFormat::R32F);
+			_encoder->dispatch(cullView, m_programHizDownscale, (size + 15)/16, (size + 15)/16);
+		}
+
+		// Occlusion test, appends the visible matrices to m_instanceOutput.
+		float viewProj[16];
+		bx::mtxMul(viewProj, _view, _proj);
+		const bgfx::Caps* caps = bgfx::getCaps();
+		const float cullParams[4] = { float(numInstances), bx::sqrt(3.0f), float(s_hizSize), float(s_hizMips) };
+		const float cullDepth[4] = { caps->homogeneousDepth ? 1.0f : 0.0f, caps->originBottomLeft ? 1.0f : 0.0f, 0.0f, 0.0f };
+		_encoder->setUniform(u_cullViewProj, viewProj);
+		_encoder->setUniform(u_cullParams, cullParams);
+		_encoder->setUniform(u_cullDepth, cullDepth);
+		_encoder->setBuffer(0, m_instanceInput, bgfx::Access::Read);
+		_encoder->setBuffer(1, m_instanceOutput, bgfx::Access::Write);
+		_encoder->setBuffer(2, m_drawCount, bgfx::Access::ReadWrite);
+		_encoder->setTexture(3, s_hiz, m_hiz, BGFX_SAMPLER_POINT|BGFX_SAMPLER_UVW_CLAMP);
+		_encoder->dispatch(cullView, m_programOcclude, (numInstances + 63)/64);
+
+		// Indirect draw arguments from the count.
+		const float drawParams[4] = { float(s_ptNumIndices[m_pt]), 0.0f, 0.0f, 0.0f };
+		_encoder->setUniform(u_drawParams, drawParams);
+		_encoder->setBuffer(0, m_drawCount, bgfx::Access::ReadWrite);
+		_encoder->setBuffer(1, m_drawArgs, bgfx::Access::Write);
+		_encoder->dispatch(cullView, m_programIndirect);
+
+		// Set vertex, index and instance data buffer, the instance count comes from m_drawArgs.
+		_encoder->setVertexBuffer(0, m_vbh);
+		_encoder->setIndexBuffer(_ibh);
+		_encoder->setInstanceDataBuffer(m_instanceOutput, 0, numInstances);
+
+		// Set render states.
+		_encoder->setState(_state);
+
+		// Submit primitive for rendering to the example view.
+		_encoder->submit(m_viewId, m_programInstanced, m_drawArgs);
+	}
+
+	// Submit the visible cubes in as few draws as the transient instance buffer allows.
+	void submitInstanced(bgfx::Encoder* _encoder, uint64_t _state, bgfx::IndexBufferHandle _ibh, float _time)
+	{
+		const uint16_t instanceStride = 64; // 4x4 matrix
+		const uint32_t numInstances = numVisible();
+
+		uint32_t instance = 0;
+		while (instance < numInstances)
+		{
+			const uint32_t num = bgfx::getAvailInstanceDataBuffer(numInstances - instance, instanceStride);
+			if (0 == num)
+			{
+				// Transient memory exhausted for this frame.
+				m_dropped += numInstances - instance;
+				break;
+			}
+
+			bgfx::InstanceDataBuffer idb;
+			bgfx::allocInstanceDataBuffer(&idb, num, instanceStride);
+
+			// Fill instance matrices in parallel, written in place.
+			const uint32_t batchFirst = instance;
+			bgfxGlobal.parallelFor(num, s_minCubesPerJob, [&](uint32_t _first, uint32_t _last)
+			{
+				m_transforms.compute(&m_visible[batchFirst + _first], _last - _first, _time, idb.data + _first*instanceStride, instanceStride);
+			});
+			instance += num;
+
+			// Set vertex, index and instance data buffer.
+			_encoder->setVertexBuffer(0, m_vbh);
+			_encoder->setIndexBuffer(_ibh);
+			_encoder->setInstanceDataBuffer(&idb);
+
+			// Set render states.
+			_encoder->setState(_state);
+
+			// Submit primitive for rendering to the example view.
+			_encoder->submit(m_viewId, m_programInstanced);
+		}
+	}
+
+	// Cubes of the frame that didn't fit in bgfx's per frame limits, logged once per grid size
+	// and drawing mode: the frame is cut short.
+	void warnDropped()
+	{
+		if (0 != m_dropped && !m_droppedWarned)
+		{
+			qWarning("Cube grid %ux%u cut short, %u of %u cubes not drawn: bgfx per frame limits reached (see InitQt_BGFX_Backend pMaxInstancedGrid)"
+				, m_grid, m_grid, bx::min<uint32_t>(m_dropped, numVisible() ), numVisible() );
+			m_droppedWarned = true;
+		}
+	}
+
+	// Record the example view through _encoder. Large grids are recorded in chunks
+	// on bgfxGlobal's record pool, one encoder per chunk.
+	bool update(bgfx::Encoder* _encoder)
 	{
 		/*
 		if (!entry::processEvents(m_width, m_height, m_debug, m_reset, &m_mouseState) )
@@ -323,25 +734,47 @@ public:
 
 			float time = (float)( (bx::getHPCounter()-m_timeOffset)/double(bx::getHPFrequency() ) );
 
-			const bx::Vec3 at  = { 0.0f, 0.0f,   0.0f };
-			const bx::Vec3 eye = { 0.0f, 0.0f, -35.0f };
+			// Step back to keep the whole grid in view, 35 units for the default 11x11 grid.
+			const float distance = bx::max(35.0f, float(m_grid)*3.2f);
+			const bx::Vec3 at  = { 0.0f, 0.0f, 0.0f };
+			const bx::Vec3 eye = { 0.0f, 0.0f, -distance };
 
-			// Set view and projection matrix for view 0.
+			// Set view and projection matrix for the example view.
+			float view[16];
+			float proj[16];
 			{
-				float view[16];
 				bx::mtxLookAt(view, eye, at);
 
-				float proj[16];
-				bx::mtxProj(proj, 60.0f, float(m_width)/float(m_height), 0.1f, 100.0f, bgfx::getCaps()->homogeneousDepth);
-				bgfx::setViewTransform(0, view, proj);
+				bx::mtxProj(proj, 60.0f, float(m_width)/float(m_height), 0.1f, bx::max(100.0f, 2.0f*distance), bgfx::getCaps()->homogeneousDepth);
+				bgfx::setViewTransform(m_viewId, view, proj);
+
+				// Set view default viewport, the scissor keeps the draws inside it when
+				// the framebuffer is shared with other items.
+				bgfx::setViewRect(m_viewId, uint16_t(m_x), uint16_t(m_y), uint16_t(m_width), uint16_t(m_height) );
+				bgfx::setViewScissor(m_viewId, uint16_t(m_x), uint16_t(m_y), uint16_t(m_width), uint16_t(m_height) );
 
-				// Set view 0 default viewport.
-				bgfx::setViewRect(0, 0, 0, uint16_t(m_width), uint16_t(m_height) );
+				// Only the cubes in view are submitted.
+				cull(view, proj);
 			}
 
-			// This dummy draw call is here to make sure that view 0 is cleared
-			// if no other draw calls are submitted to view 0.
-			bgfx::touch(0);
+			// This dummy draw call is here to make sure that the view is cleared
+			// if no other draw calls are submitted to it.
+			_encoder->touch(m_viewId);
+
+			// Background on the far plane, only where no cube is drawn.
+			if (bgfx::isValid(m_background) && bgfx::isValid(m_backgroundProgram) )
+			{
+				_encoder->setVertexBuffer(0, m_backgroundVbh);
+				_encoder->setTexture(0, s_texColor, m_background);
+				_encoder->setUniform(u_texLod, m_backgroundLod);
+				_encoder->setState(0
+					| BGFX_STATE_WRITE_RGB
+					| BGFX_STATE_WRITE_A
+					| BGFX_STATE_DEPTH_TEST_LEQUAL
+					| BGFX_STATE_PT_TRISTRIP
+					);
+				_encoder->submit(m_viewId, m_backgroundProgram);
+			}
 
 			bgfx::IndexBufferHandle ibh = m_ibh[m_pt];
 			uint64_t state = 0
@@ -356,36 +789,61 @@ public:
 				| s_ptState[m_pt]
 				;
 
-			// Submit 11x11 cubes.
-			for (uint32_t yy = 0; yy < 11; ++yy)
+			m_dropped = 0;
+			if (isOcclusionCulled() )
 			{
-				for (uint32_t xx = 0; xx < 11; ++xx)
-				{
-					float mtx[16];
-					bx::mtxRotateXY(mtx, time + xx*0.21f, time + yy*0.37f);
-					mtx[12] = -15.0f + float(xx)*3.0f;
-					mtx[13] = -15.0f + float(yy)*3.0f;
-					mtx[14] = 0.0f;
-
-					// Set model matrix for rendering.
-					bgfx::setTransform(mtx);
+				submitOcclusionCulled(_encoder, view, proj, state, ibh, time);
+				return true;
+			}
 
-					// Set vertex and index buffer.
-					bgfx::setVertexBuffer(0, m_vbh);
-					bgfx::setIndexBuffer(ibh);
+			if (isInstanced() )
+			{
+				submitInstanced(_encoder, state, ibh, time);
+				warnDropped();
+				return true;
+			}
 
-					// Set render states.
-					bgfx::setState(state);
+			// bgfx drops the submissions over its draw call limit (shared by all the views)
+			const uint32_t maxDrawCalls = bgfx::getCaps()->limits.maxDrawCalls;
+			if (numVisible() > maxDrawCalls)
+			{
+				m_dropped += numVisible() - maxDrawCalls;
+			}
 
-					// Submit primitive for rendering to view 0.
-					bgfx::submit(0, m_program);
+			// Submit the visible cubes of the m_grid x m_grid grid.
+			bgfxGlobal.parallelRecord(numVisible(), s_minCubesPerJob, _encoder, [&](bgfx::Encoder* _chunkEncoder, uint32_t _first, uint32_t _last)
+			{
+				for (uint32_t first = _first; first < _last; first += s_transformsPerAlloc)
+				{
+					// Model matrices written in place to the transform cache (fewer than
+					// requested if the cache is exhausted for this frame).
+					const uint16_t num = uint16_t(bx::min<uint32_t>(_last - first, uint32_t(s_transformsPerAlloc) ) );
+					bgfx::Transform transform;
+					const uint32_t cache = _chunkEncoder->allocTransform(&transform, num);
+					m_transforms.compute(&m_visible[first], transform.num, time, (uint8_t*)transform.data, 64);
+					m_dropped += uint32_t(num - transform.num);
+
+					for (uint16_t ii = 0; ii < transform.num; ++ii)
+					{
+						// Set model matrix for rendering.
+						_chunkEncoder->setTransform(cache + ii);
+
+						// Set vertex and index buffer.
+						_chunkEncoder->setVertexBuffer(0, m_vbh);
+						_chunkEncoder->setIndexBuffer(ibh);
+
+						// Set render states.
+						_chunkEncoder->setState(state);
+
+						// Submit primitive for rendering to the example view.
+						_chunkEncoder->submit(m_viewId, m_program);
+					}
 				}
-			}
+			});
+
+			// bgfx::frame() is kicked by bgfxGlobal once every item has recorded its views.
+			warnDropped();
 
-			// Advance to next frame. Rendering thread will be kicked to
-			// process submitted rendering primitives.
-			bgfx::frame();
-			
 			return true;
 			/*
 		}
@@ -398,6 +856,9 @@ public:
 	entry::MouseState m_mouseState;
 	*/
 
+	bgfx::ViewId m_viewId;
+	uint32_t m_x;
+	uint32_t m_y;
 	uint32_t m_width;
 	uint32_t m_height;
 	uint32_t m_debug;
@@ -405,6 +866,42 @@ public:
 	bgfx::VertexBufferHandle m_vbh;
 	bgfx::IndexBufferHandle m_ibh[BX_COUNTOF(s_ptState)];
 	bgfx::ProgramHandle m_program;
+	bgfx::ProgramHandle m_programInstanced;
+	bgfx::VertexBufferHandle m_backgroundVbh;
+	bgfx::ProgramHandle m_backgroundProgram;
+	bgfx::UniformHandle s_texColor;
+	bgfx::UniformHandle u_texLod;
+	bgfx::TextureHandle m_background;
+	float m_backgroundLod[4];
+	uint32_t m_grid;
+	bool m_instanced;
+	bool m_occlusionCulling;
+	bool m_occlusionSupported;
+	bgfx::ProgramHandle m_programHizCopy;
+	bgfx::ProgramHandle m_programHizDownscale;
+	bgfx::ProgramHandle m_programOcclude;
+	bgfx::ProgramHandle m_programIndirect;
+	bgfx::UniformHandle s_hizDepth;
+	bgfx::UniformHandle s_hiz;
+	bgfx::UniformHandle u_hizParams;
+	bgfx::UniformHandle u_cullViewProj;
+	bgfx::UniformHandle u_cullParams;
+	bgfx::UniformHandle u_cullDepth;
+	bgfx::UniformHandle u_drawParams;
+	bgfx::TextureHandle m_hizDepth;
+	bgfx::FrameBufferHandle m_hizFb;
+	bgfx::TextureHandle m_hiz;
+	bgfx::DynamicVertexBufferHandle m_instanceInput;
+	bgfx::DynamicVertexBufferHandle m_instanceOutput;
+	uint32_t m_instanceCapacity;
+	bgfx::DynamicIndexBufferHandle m_drawCount;
+	bgfx::IndirectBufferHandle m_drawArgs;
+	AnimatedTransforms m_transforms;
+	BoundingSpheres m_bounds;
+	std::vector<uint8_t> m_cullMask;
+	std::vector<uint32_t> m_visible;
+	std::atomic<uint32_t> m_dropped;
+	bool m_droppedWarned;
 	int64_t m_timeOffset;
 	int32_t m_pt;
 
@@ -0,0 +1,14 @@
+#include <bgfx_compute.sh>
+
+// Indirect draw of the cubes kept by cubes_occlude, the count is reset for the next frame
+BUFFER_RW(b_drawCount, uint,  0);
+BUFFER_WR(b_drawArgs,  uvec4, 1);
+
+uniform vec4 u_drawParams; // x: number of indices of the cube
+
+NUM_THREADS(1, 1, 1)
+void main()
+{
+	drawIndexedIndirect(b_drawArgs, 0u, uint(u_drawParams.x), b_drawCount[0], 0u, 0u, 0u);
+	b_drawCount[0] = 0u;
+}
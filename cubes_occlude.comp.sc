@@ -0,0 +1,82 @@
+#include <bgfx_compute.sh>
+
+// Hierarchical Z occlusion test of the frustum visible cubes. The model matrices of
+// the cubes passing it are appended to b_instanceOut, b_drawCount counts them.
+BUFFER_RO(b_instanceIn,  vec4, 0);
+BUFFER_WR(b_instanceOut, vec4, 1);
+BUFFER_RW(b_drawCount,   uint, 2);
+SAMPLER2D(s_hiz, 3);
+
+uniform mat4 u_cullViewProj;
+uniform vec4 u_cullParams; // x: number of cubes, y: bounding sphere radius, z: Hi-Z size, w: Hi-Z mip count
+uniform vec4 u_cullDepth;  // x: 1 for a [-1, 1] clip depth, y: 1 for a bottom left texture origin
+
+NUM_THREADS(64, 1, 1)
+void main()
+{
+	uint id = gl_GlobalInvocationID.x;
+	if (id >= uint(u_cullParams.x) )
+	{
+		return;
+	}
+
+	vec4 col0 = b_instanceIn[id*4u + 0u];
+	vec4 col1 = b_instanceIn[id*4u + 1u];
+	vec4 col2 = b_instanceIn[id*4u + 2u];
+	vec4 col3 = b_instanceIn[id*4u + 3u];
+
+	// Normalized device bounds of the box around the cube's bounding sphere
+	vec3 center = col3.xyz;
+	float radius = u_cullParams.y;
+	vec3 ndcMin = vec3( 1.0,  1.0,  1.0);
+	vec3 ndcMax = vec3(-1.0, -1.0, -1.0);
+	bool behind = false;
+	for (int ii = 0; ii < 8; ++ii)
+	{
+		vec3 corner = center + radius*vec3(
+			  (ii & 1) != 0 ? 1.0 : -1.0
+			, (ii & 2) != 0 ? 1.0 : -1.0
+			, (ii & 4) != 0 ? 1.0 : -1.0
+			);
+		vec4 clip = mul(u_cullViewProj, vec4(corner, 1.0) );
+		behind = behind || clip.w <= 0.0;
+		vec3 ndc = clip.xyz / clip.w;
+		ndcMin = min(ndcMin, ndc);
+		ndcMax = max(ndcMax, ndc);
+	}
+
+	// Crossing the near plane: kept
+	bool visible = true;
+	if (!behind)
+	{
+		float nearest = u_cullDepth.x != 0.0 ? ndcMin.z*0.5 + 0.5 : ndcMin.z;
+		vec2 uvMin = clamp(ndcMin.xy*0.5 + 0.5, 0.0, 1.0);
+		vec2 uvMax = clamp(ndcMax.xy*0.5 + 0.5, 0.0, 1.0);
+		if (u_cullDepth.y == 0.0)
+		{
+			vec2 flipped = vec2(1.0 - uvMax.y, 1.0 - uvMin.y);
+			uvMin.y = flipped.x;
+			uvMax.y = flipped.y;
+		}
+
+		// Mip where the bounds cover at most 2x2 texels
+		vec2 size = (uvMax - uvMin)*u_cullParams.z;
+		float lod = clamp(ceil(log2(max(max(size.x, size.y), 1.0) ) ), 0.0, u_cullParams.w - 1.0);
+
+		float farthest = texture2DLod(s_hiz, uvMin, lod).x;
+		farthest = max(farthest, texture2DLod(s_hiz, vec2(uvMax.x, uvMin.y), lod).x);
+		farthest = max(farthest, texture2DLod(s_hiz, vec2(uvMin.x, uvMax.y), lod).x);
+		farthest = max(farthest, texture2DLod(s_hiz, uvMax, lod).x);
+		visible = nearest <= farthest;
+	}
+
+	if (visible)
+	{
+		uint index;
+		atomicFetchAndAdd(b_drawCount[0], 1u, index);
+		b_instanceOut[index*4u + 0u] = col0;
+		b_instanceOut[index*4u + 1u] = col1;
+		b_instanceOut[index*4u + 2u] = col2;
+		b_instanceOut[index*4u + 3u] = col3;
+	}
+}
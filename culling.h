@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "simd4.h"
+
+/******************************************************************************/
+// View frustum as 6 planes (a, b, c, d), inside when a*x + b*y + c*z + d >= 0
+struct Frustum
+{
+    float planes[6][4];
+
+    // pViewProj in bx convention (row vectors, translation in [12..14]).
+    // pHomogeneousDepth is bgfx::Caps::homogeneousDepth (GL clip z in [-w, w]).
+    void build(const float* pViewProj, bool pHomogeneousDepth)
+    {
+        auto column = [pViewProj](int pCol, int pRow) { return pViewProj[pRow * 4 + pCol]; };
+        for (int ii = 0; ii < 4; ++ii)
+        {
+            const float xx = column(0, ii);
+            const float yy = column(1, ii);
+            const float zz = column(2, ii);
+            const float ww = column(3, ii);
+            planes[0][ii] = ww + xx;    // left
+            planes[1][ii] = ww - xx;    // right
+            planes[2][ii] = ww + yy;    // bottom
+            planes[3][ii] = ww - yy;    // top
+            planes[4][ii] = pHomogeneousDepth ? ww + zz : zz; // near
+            planes[5][ii] = ww - zz;    // far
+        }
+    }
+};
+
+/******************************************************************************/
+// Bounding spheres in structure of arrays layout: the culling loop runs over
+// contiguous floats, 4 spheres at a time with SSE2 or NEON (simd4.h).
+struct BoundingSpheres
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+
+    uint32_t size() const { return uint32_t(x.size()); }
+
+    void resize(uint32_t pCount)
+    {
+        x.resize(pCount);
+        y.resize(pCount);
+        z.resize(pCount);
+        radius.resize(pCount);
+    }
+
+    // pVisible[ii] = 1 if sphere ii in [pFirst, pLast) intersects pFrustum, else 0
+    void cull(const Frustum& pFrustum, uint8_t* pVisible, uint32_t pFirst, uint32_t pLast) const
+    {
+        const float* xs = x.data();
+        const float* ys = y.data();
+        const float* zs = z.data();
+        const float* rs = radius.data();
+
+        // The 6 planes per sphere, no branch
+        uint32_t ii = pFirst;
+#if SIMD4_ENABLED
+        SimdFloat4 planes[6][4];
+        for (int pp = 0; pp < 6; ++pp)
+        {
+            for (int cc = 0; cc < 4; ++cc)
+                planes[pp][cc] = simdSplat(pFrustum.planes[pp][cc]);
+        }
+        for (; ii + 4 <= pLast; ii += 4)
+        {
+            const SimdFloat4 sx = simdLoad(xs + ii);
+            const SimdFloat4 sy = simdLoad(ys + ii);
+            const SimdFloat4 sz = simdLoad(zs + ii);
+            const SimdFloat4 minDistance = simdSub(simdSplat(0.f), simdLoad(rs + ii));
+            SimdFloat4 inside = simdCmpGe(simdSplat(0.f), simdSplat(0.f)); // all set
+            for (const SimdFloat4* plane : planes)
+            {
+                const SimdFloat4 distance = simdAdd(simdAdd(simdAdd(simdMul(plane[0], sx), simdMul(plane[1], sy)),
+                    simdMul(plane[2], sz)), plane[3]);
+                inside = simdAnd(inside, simdCmpGe(distance, minDistance));
+            }
+            const int mask = simdMask(inside);
+            pVisible[ii] = uint8_t(mask & 1);
+            pVisible[ii + 1] = uint8_t((mask >> 1) & 1);
+            pVisible[ii + 2] = uint8_t((mask >> 2) & 1);
+            pVisible[ii + 3] = uint8_t((mask >> 3) & 1);
+        }
+#endif
+        for (; ii < pLast; ++ii)
+        {
+            uint8_t visible = 1;
+            for (const float* plane : pFrustum.planes)
+            {
+                const float distance = plane[0] * xs[ii] + plane[1] * ys[ii] + plane[2] * zs[ii] + plane[3];
+                visible &= uint8_t(distance >= -rs[ii]);
+            }
+            pVisible[ii] = visible;
+        }
+    }
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <QtCore/QtGlobal>
+#include <bgfx/bgfx.h>
+#include <cstring>
+
+/******************************************************************************/
+// Shader binary compiled at build time by shaderc and embedded in the executable
+struct EmbeddedShaderBinary
+{
+    const char* name;               // source file name without .sc, e.g. "cubes.vert"
+    bgfx::RendererType::Enum type;
+    const uint8_t* data;
+    uint32_t size;
+};
+
+// Generated by CMake (embed_shaders() in CMakeLists.txt): includes one bin2c array per
+// shader and profile, and defines s_embeddedShaders[] listing them.
+#include "embeddedShaderData.h"
+
+/******************************************************************************/
+// Binary of pName for pType, nullptr if it isn't embedded.
+// The Noop renderer only parses the shader header, any profile does.
+inline const EmbeddedShaderBinary* findEmbeddedShader(const char* pName, bgfx::RendererType::Enum pType)
+{
+    const EmbeddedShaderBinary* fallback = nullptr;
+    for (const EmbeddedShaderBinary& shader : s_embeddedShaders)
+    {
+        if (std::strcmp(shader.name, pName) != 0)
+            continue;
+        if (shader.type == pType)
+            return &shader;
+        if (!fallback)
+            fallback = &shader;
+    }
+    return pType == bgfx::RendererType::Noop ? fallback : nullptr;
+}
+
+/******************************************************************************/
+// Create a bgfx shader referencing the embedded binary, no copy
+inline bgfx::ShaderHandle createEmbeddedShader(const char* pName, bgfx::RendererType::Enum pType)
+{
+    const EmbeddedShaderBinary* shader = findEmbeddedShader(pName, pType);
+    if (!shader)
+    {
+        qWarning("Shader %s isn't embedded for %s", pName, bgfx::getRendererName(pType));
+        return BGFX_INVALID_HANDLE;
+    }
+
+    bgfx::ShaderHandle handle = bgfx::createShader(bgfx::makeRef(shader->data, shader->size));
+    bgfx::setName(handle, pName);
+    return handle;
+}
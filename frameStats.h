@@ -0,0 +1,146 @@
+#pragma once
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QTextStream>
+
+#include <algorithm>
+#include <vector>
+
+/******************************************************************************/
+// Timings of one recorded bgfx frame, in milliseconds
+struct FrameSample
+{
+    uint32_t frame = 0;         // bgfx frame number
+    float recordMs = 0.f;       // CPU time recording the item views
+    float frameMs = 0.f;        // CPU time spent in bgfx::frame()
+    float gpuMs = 0.f;          // bgfx Stats gpuTimeEnd - gpuTimeBegin
+    float waitRenderMs = 0.f;   // bgfx Stats waitRender
+    float waitSubmitMs = 0.f;   // bgfx Stats waitSubmit
+    uint32_t numDraw = 0;       // bgfx Stats numDraw (all items)
+};
+
+/******************************************************************************/
+// Rolling window of the last Capacity samples
+class FrameStatsHistory
+{
+public:
+    static const int Capacity = 600;
+
+    void add(const FrameSample& pSample)
+    {
+        if (m_samples.size() < size_t(Capacity))
+        {
+            m_samples.push_back(pSample);
+        }
+        else
+        {
+            m_samples[m_next] = pSample;
+        }
+        m_next = (m_next + 1) % Capacity;
+    }
+
+    bool isEmpty() const { return m_samples.empty(); }
+
+    const FrameSample& last() const
+    {
+        return m_samples[(m_next + Capacity - 1) % Capacity];
+    }
+
+    // pPercents in [0, 100] and ascending, nearest rank. The values are copied once into
+    // a scratch buffer, each rank is then selected among the values above the previous one.
+    void percentiles(float FrameSample::* pField, const float* pPercents, float* pValues, int pCount) const
+    {
+        if (m_samples.empty())
+        {
+            std::fill(pValues, pValues + pCount, 0.f);
+            return;
+        }
+
+        m_scratch.clear();
+        for (const FrameSample& sample : m_samples)
+            m_scratch.push_back(sample.*pField);
+
+        auto first = m_scratch.begin();
+        for (int ii = 0; ii < pCount; ++ii)
+        {
+            const size_t rank = std::min(m_scratch.size() - 1, size_t(pPercents[ii] / 100.f * m_scratch.size()));
+            const auto nth = std::max(first, m_scratch.begin() + rank);
+            std::nth_element(first, nth, m_scratch.end());
+            pValues[ii] = *nth;
+            first = nth;
+        }
+    }
+
+    // Samples from the oldest to the newest
+    std::vector<FrameSample> ordered() const
+    {
+        std::vector<FrameSample> result;
+        result.reserve(m_samples.size());
+        const size_t first = m_samples.size() < size_t(Capacity) ? 0 : m_next;
+        for (size_t ii = 0; ii < m_samples.size(); ++ii)
+            result.push_back(m_samples[(first + ii) % m_samples.size()]);
+        return result;
+    }
+
+    // CSV if pPath ends with .csv, JSON otherwise
+    bool write(const QString& pPath) const
+    {
+        QFile file(pPath);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+            return false;
+
+        const std::vector<FrameSample> samples = ordered();
+        if (pPath.endsWith(QLatin1String(".csv"), Qt::CaseInsensitive))
+        {
+            QTextStream out(&file);
+            out << "frame,recordMs,frameMs,gpuMs,waitRenderMs,waitSubmitMs,numDraw\n";
+            for (const FrameSample& sample : samples)
+            {
+                out << sample.frame << ',' << sample.recordMs << ',' << sample.frameMs << ',' << sample.gpuMs << ','
+                    << sample.waitRenderMs << ',' << sample.waitSubmitMs << ',' << sample.numDraw << '\n';
+            }
+            return true;
+        }
+
+        QJsonArray frames;
+        for (const FrameSample& sample : samples)
+        {
+            QJsonObject frame;
+            frame["frame"] = int(sample.frame);
+            frame["recordMs"] = sample.recordMs;
+            frame["frameMs"] = sample.frameMs;
+            frame["gpuMs"] = sample.gpuMs;
+            frame["waitRenderMs"] = sample.waitRenderMs;
+            frame["waitSubmitMs"] = sample.waitSubmitMs;
+            frame["numDraw"] = int(sample.numDraw);
+            frames.append(frame);
+        }
+
+        QJsonObject summary;
+        const float percents[] = { 50.f, 95.f, 99.f };
+        float recordMs[3], frameMs[3], gpuMs[3];
+        percentiles(&FrameSample::recordMs, percents, recordMs, 3);
+        percentiles(&FrameSample::frameMs, percents, frameMs, 3);
+        percentiles(&FrameSample::gpuMs, percents, gpuMs, 3);
+        for (int ii = 0; ii < 3; ++ii)
+        {
+            const QString suffix = QString("P%1").arg(int(percents[ii]));
+            summary["recordMs" + suffix] = recordMs[ii];
+            summary["frameMs" + suffix] = frameMs[ii];
+            summary["gpuMs" + suffix] = gpuMs[ii];
+        }
+
+        QJsonObject root;
+        root["summary"] = summary;
+        root["frames"] = frames;
+        file.write(QJsonDocument(root).toJson());
+        return true;
+    }
+
+private:
+    std::vector<FrameSample> m_samples;
+    size_t m_next = 0;
+    mutable std::vector<float> m_scratch;   // percentiles(), grows to Capacity once
+};
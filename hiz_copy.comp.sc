@@ -0,0 +1,18 @@
+#include <bgfx_compute.sh>
+
+// Occluder depth buffer copied to mip 0 of the hierarchical Z map
+SAMPLER2D(s_hizDepth, 0);
+IMAGE2D_WR(s_hizOut, r32f, 1);
+
+uniform vec4 u_hizParams; // xy: output mip size
+
+NUM_THREADS(16, 16, 1)
+void main()
+{
+	ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+	if (all(lessThan(coord, ivec2(u_hizParams.xy) ) ) )
+	{
+		float depth = texelFetch(s_hizDepth, coord, 0).x;
+		imageStore(s_hizOut, coord, vec4(depth, 0.0, 0.0, 1.0) );
+	}
+}
@@ -0,0 +1,22 @@
+#include <bgfx_compute.sh>
+
+// Next mip of the hierarchical Z map: farthest depth of the 2x2 texels it covers
+IMAGE2D_RO(s_hizIn, r32f, 0);
+IMAGE2D_WR(s_hizOut, r32f, 1);
+
+uniform vec4 u_hizParams; // xy: output mip size
+
+NUM_THREADS(16, 16, 1)
+void main()
+{
+	ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+	if (all(lessThan(coord, ivec2(u_hizParams.xy) ) ) )
+	{
+		ivec2 src = coord*2;
+		float depth = imageLoad(s_hizIn, src).x;
+		depth = max(depth, imageLoad(s_hizIn, src + ivec2(1, 0) ).x);
+		depth = max(depth, imageLoad(s_hizIn, src + ivec2(0, 1) ).x);
+		depth = max(depth, imageLoad(s_hizIn, src + ivec2(1, 1) ).x);
+		imageStore(s_hizOut, coord, vec4(depth, 0.0, 0.0, 1.0) );
+	}
+}
@@ -1,5 +1,6 @@
 #include <QGuiApplication>
 #include <QOpenGLContext>
+#include <QtCore/QThread>
 #include <QtQuick/QQuickView>
 #include "bgfxItem.h"
 
@@ -7,7 +8,7 @@
 int main(int argc, char **argv)
 {
     //https://doc.qt.io/qt-5/qtquick-visualcanvas-scenegraph.html#scene-graph-and-rendering
-    // "basic/windows/threaded"
+    // "basic/windows/threaded", threaded requires ThreadingMode::WorkerThread (else InitQt_BGFX_Backend switches back to basic)
     qputenv("QSG_RENDER_LOOP", "basic");
     //qputenv("QSG_RENDER_LOOP", "threaded");
 
@@ -23,8 +24,16 @@ int main(int argc, char **argv)
     // ExternPlatform,             // Use platformData to set backBuffer (require this 'hack' https://github.com/VirtualGeo/bgfx/commit/0a4193bd31c902ed64288a067d02bfac95114a0d)
     // SynchroFramebuffer,         // Create a bgfx::Framebuffer synchronized with extern Texture handle given by Qt (don't work well, require some hack)
     // OffscreenFramebuffer,       // Create a bgfx::Framebuffer, render to it, then blit result (works)
-    InitQt_BGFX_Backend(QSGRendererInterface::Direct3D11Rhi, InteropMode::OffscreenFramebuffer);
-    qDebug() << "MainThread " << GetCurrentThreadId();
+    // TextureNode,                // Create a bgfx::Framebuffer, render to it, then let the scene graph sample it (zero-copy)
+    // TextureAtlas,               // Same as TextureNode, items render into regions of a shared render target (many small items)
+    // ThreadingMode::SingleThread / ThreadingMode::MultiThread (bgfx API on a worker thread, OffscreenFramebuffer/TextureNode/TextureAtlas only)
+    // ThreadingMode::WorkerThread (bgfx API and rendering on a worker thread, one render thread per window, OpenGLRhi only)
+#ifdef _WIN32
+    InitQt_BGFX_Backend(QSGRendererInterface::Direct3D11Rhi, InteropMode::OffscreenFramebuffer, ThreadingMode::SingleThread);
+#else
+    InitQt_BGFX_Backend(QSGRendererInterface::OpenGLRhi, InteropMode::OffscreenFramebuffer, ThreadingMode::SingleThread);
+#endif
+    qDebug() << "MainThread " << QThread::currentThreadId();
 
     QQuickView view;
     view.setResizeMode(QQuickView::SizeRootObjectToView);
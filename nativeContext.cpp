@@ -0,0 +1,66 @@
+#include "nativeContext.h"
+
+#include <QOpenGLContext>
+#include <atomic>
+
+// Kept in its own translation unit: the GLX and EGL headers include Xlib, and its
+// macros (None, Bool, Status ...) clash with Qt and bgfx names
+#ifdef _WIN32
+#include <QtPlatformHeaders/QWGLNativeContext>
+#else
+#include <QtPlatformHeaders/QEGLNativeContext>
+#include <QtPlatformHeaders/QGLXNativeContext>
+#endif
+
+// CMake BGFX_GL_EGL: bgfx's OpenGL renderer is built with EGL instead of GLX on Linux
+#ifndef BGFX_GL_EGL
+#define BGFX_GL_EGL 0
+#endif
+
+/******************************************************************************/
+// Qt asks for the context every frame, its errors are logged once
+static bool logOnce()
+{
+    static std::atomic_flag logged = ATOMIC_FLAG_INIT;
+    return !logged.test_and_set();
+}
+
+/******************************************************************************/
+NativeGLContext nativeGLContext(QOpenGLContext* pContext)
+{
+    NativeGLContext native;
+    const QVariant handle = pContext->nativeHandle();
+#ifdef _WIN32
+    if (handle.canConvert<QWGLNativeContext>())
+        native.context = (void*)handle.value<QWGLNativeContext>().context();
+#else
+    // xcb uses GLX by default, EGL with QT_XCB_GL_INTEGRATION=xcb_egl and on eglfs.
+    // bgfx only drives the one it is built for, the other is refused: bgfx would
+    // call GLX on an EGLContext (or the reverse) and crash.
+    const bool glx = handle.canConvert<QGLXNativeContext>();
+    const bool egl = handle.canConvert<QEGLNativeContext>();
+    if ((glx && BGFX_GL_EGL) || (egl && !BGFX_GL_EGL))
+    {
+        if (logOnce())
+            qCritical("Qt's OpenGL context uses %s but bgfx is built for %s, BgfxItems won't be rendered."
+                " Use Qt's %s integration, or rebuild bgfx and configure with -DBGFX_GL_EGL=%s",
+                glx ? "GLX" : "EGL", glx ? "EGL" : "GLX", glx ? "EGL" : "GLX", glx ? "OFF" : "ON");
+        return native;
+    }
+
+    if (glx)
+    {
+        const QGLXNativeContext context = handle.value<QGLXNativeContext>();
+        native.context = (void*)context.context();
+        native.display = (void*)context.display();
+    }
+    else if (egl)
+    {
+        // bgfx uses the display of the current context
+        native.context = (void*)handle.value<QEGLNativeContext>().context();
+    }
+#endif
+    if (!native.context && logOnce())
+        qWarning("Unsupported native GL context %s", handle.typeName());
+    return native;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+class QOpenGLContext;
+
+/******************************************************************************/
+// Native handles of a Qt GL context, for bgfx::PlatformData
+struct NativeGLContext
+{
+    void* context = nullptr;    // HGLRC, GLXContext or EGLContext
+    void* display = nullptr;    // X11 Display* with GLX (PlatformData::ndt), else null
+};
+
+// Null context if the platform integration isn't supported (WGL, GLX, EGL), or on Linux
+// isn't the one bgfx is built for (CMake BGFX_GL_EGL)
+NativeGLContext nativeGLContext(QOpenGLContext* pContext);
@@ -0,0 +1,266 @@
+#pragma once
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
+#include <bgfx/bgfx.h>
+#include <bx/hash.h>
+#include <stb/stb_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "textureStream.h"
+
+/******************************************************************************/
+// Multiple producers, single consumer lock-free queue.
+// Producers push on an intrusive stack, the consumer takes the whole stack at once
+// (no ABA) and reverses it to get the values in push order.
+template<typename T>
+class MpscQueue
+{
+public:
+    ~MpscQueue()
+    {
+        std::deque<T> values;
+        popAll(values);
+    }
+
+    // Any thread
+    void push(T pValue)
+    {
+        Node* node = new Node{ std::move(pValue), m_head.load(std::memory_order_relaxed) };
+        while (!m_head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    // Consumer thread only, appends the values to pValues, oldest first
+    void popAll(std::deque<T>& pValues)
+    {
+        Node* node = m_head.exchange(nullptr, std::memory_order_acquire);
+        Node* reversed = nullptr;
+        while (node)
+        {
+            Node* next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+        while (reversed)
+        {
+            Node* next = reversed->next;
+            pValues.push_back(std::move(reversed->value));
+            delete reversed;
+            reversed = next;
+        }
+    }
+
+private:
+    struct Node
+    {
+        T value;
+        Node* next;
+    };
+    std::atomic<Node*> m_head{ nullptr };
+};
+
+/******************************************************************************/
+// Asynchronous resource loading.
+// Files are read and decoded on the loader pool, decoded data is handed back to the
+// bgfx API thread through an MpscQueue. processUploads() hands it over and streams
+// texture levels, at most pBudgetBytes per call so a burst of loads doesn't stall a
+// frame. Everything but the decoding runs on the bgfx API thread.
+class bgfxResourceLoader
+{
+public:
+    typedef uint32_t Ticket;
+    static const Ticket InvalidTicket = 0;
+    typedef std::function<void(std::shared_ptr<const MipChain>)> MipsCallback;
+
+    bgfxResourceLoader()
+    {
+        // Loads are mostly I/O bound, don't compete with the record pool
+        m_pool.setMaxThreadCount(2);
+    }
+
+    ~bgfxResourceLoader()
+    {
+        shutdown();
+    }
+
+    // Load an image file (any path QFile opens, ":/" for resources) with its full RGBA8
+    // mip chain, for a TextureStream. Files of the same content share the chain still in
+    // use, else it is read from the disk cache if it was built before. pDone is called
+    // from processUploads(), with null if the load failed.
+    Ticket loadMips(const QString& pPath, MipsCallback pDone)
+    {
+        const Ticket ticket = nextTicket();
+        m_requests[ticket] = std::move(pDone);
+        m_pool.start(new DecodeJob(this, ticket, pPath));
+        return ticket;
+    }
+
+    // pDone won't be called, the decoded data is dropped
+    void cancel(Ticket pTicket)
+    {
+        m_requests.erase(pTicket);
+    }
+
+    // Streams share the upload budget
+    void addStream(TextureStream* pStream)
+    {
+        m_streams.push_back(pStream);
+    }
+
+    void removeStream(TextureStream* pStream)
+    {
+        m_streams.erase(std::remove(m_streams.begin(), m_streams.end(), pStream), m_streams.end());
+    }
+
+    // Hand the decoded chains over and stream texture levels, once per bgfx frame. The
+    // first upload is always done, even if it's larger than the budget.
+    void processUploads(uint32_t pBudgetBytes)
+    {
+        m_decoded.popAll(m_ready);
+        for (Decoded& decoded : m_ready)
+        {
+            auto request = m_requests.find(decoded.ticket);
+            if (request == m_requests.end())
+                continue; // cancelled
+            MipsCallback done = std::move(request->second);
+            m_requests.erase(request);
+            done(std::move(decoded.mips));
+        }
+        m_ready.clear();
+
+        uint32_t budget = pBudgetBytes;
+        bool uploaded = false;
+        // One level per stream and per pass, so every stream progresses
+        for (bool progress = true; progress; )
+        {
+            progress = false;
+            for (TextureStream* stream : m_streams)
+            {
+                if (stream->step(budget, !uploaded))
+                    progress = uploaded = true;
+            }
+        }
+    }
+
+    // Wait for the running loads and drop everything, before bgfx::shutdown()
+    void shutdown()
+    {
+        m_pool.waitForDone();
+        m_decoded.popAll(m_ready);
+        m_ready.clear();
+        m_requests.clear();
+        m_streams.clear();
+    }
+
+private:
+    Ticket nextTicket()
+    {
+        if (++m_lastTicket == InvalidTicket)
+            ++m_lastTicket;
+        return m_lastTicket;
+    }
+
+    struct Decoded
+    {
+        Ticket ticket;
+        std::shared_ptr<const MipChain> mips; // null if the load failed
+    };
+
+    // Chain of pHash still referenced by a stream or a load, pool threads
+    std::shared_ptr<const MipChain> findMips(uint32_t pHash)
+    {
+        QMutexLocker lock(&m_mipsMutex);
+        auto found = m_mips.find(pHash);
+        return found != m_mips.end() ? found->second.lock() : nullptr;
+    }
+
+    void addMips(const std::shared_ptr<const MipChain>& pMips)
+    {
+        QMutexLocker lock(&m_mipsMutex);
+        for (auto it = m_mips.begin(); it != m_mips.end(); )
+            it = it->second.expired() ? m_mips.erase(it) : std::next(it);
+        m_mips[pMips->hash] = pMips;
+    }
+
+    class DecodeJob : public QRunnable
+    {
+    public:
+        DecodeJob(bgfxResourceLoader* pLoader, Ticket pTicket, const QString& pPath)
+            : mLoader(pLoader), mTicket(pTicket), mPath(pPath) { }
+
+        void run() override
+        {
+            Decoded decoded = { mTicket, nullptr };
+            QFile file(mPath);
+            if (file.open(QIODevice::ReadOnly))
+            {
+                const QByteArray data = file.readAll();
+                const uint32_t hash = bx::hash<bx::HashMurmur2A>(data.constData(), uint32_t(data.size()));
+                decoded.mips = mLoader->findMips(hash);
+                if (decoded.mips)
+                {
+                    mLoader->m_decoded.push(decoded);
+                    return;
+                }
+
+                std::shared_ptr<MipChain> mips = std::make_shared<MipChain>();
+                if (mips->readCache(hash))
+                {
+                    decoded.mips = mips;
+                }
+                else
+                {
+                    int width = 0, height = 0, channels = 0;
+                    stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(data.constData()), data.size(),
+                        &width, &height, &channels, 4);
+                    if (pixels)
+                    {
+                        mips->hash = hash;
+                        mips->generate(pixels, uint32_t(width), uint32_t(height));
+                        mips->writeCache();
+                        stbi_image_free(pixels);
+                        decoded.mips = mips;
+                    }
+                }
+            }
+            if (!decoded.mips)
+            {
+                qWarning("Can't load texture %s", qPrintable(mPath));
+            }
+            else if (decoded.mips->width > uint32_t(bgfx::getCaps()->limits.maxTextureSize) || decoded.mips->height > uint32_t(bgfx::getCaps()->limits.maxTextureSize))
+            {
+                qWarning("Texture %s is too large (%ux%u)", qPrintable(mPath), decoded.mips->width, decoded.mips->height);
+                decoded.mips = nullptr;
+            }
+            else
+            {
+                mLoader->addMips(decoded.mips);
+            }
+            mLoader->m_decoded.push(decoded);
+        }
+
+    private:
+        bgfxResourceLoader* mLoader;
+        Ticket mTicket;
+        QString mPath;
+    };
+
+    QThreadPool m_pool;
+    MpscQueue<Decoded> m_decoded;           // pushed by the pool
+    std::deque<Decoded> m_ready;            // popped, API thread only
+    std::map<Ticket, MipsCallback> m_requests; // loads in flight, API thread only
+    QMutex m_mipsMutex;
+    std::map<uint32_t, std::weak_ptr<const MipChain>> m_mips; // by content hash, see loadMips()
+    std::vector<TextureStream*> m_streams;
+    Ticket m_lastTicket = InvalidTicket;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+/******************************************************************************/
+// 4 wide float operations on the SIMD instruction set every target has without
+// compile flags: SSE2 on x86-64 (and x86 with /arch:SSE2, -msse2), NEON on
+// AArch64 (and ARMv7 with -mfpu=neon). SIMD4_ENABLED is 0 elsewhere, callers keep
+// a scalar loop, also used for the remainder of the ranges.
+// Only 4 wide: there is no AVX/AVX2 8 wide path, which would need its own compile
+// flags per function and a runtime CPU check, as the build targets baseline x86-64.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD4_ENABLED 1
+#define SIMD4_SSE2 1
+#include <emmintrin.h>
+typedef __m128 SimdFloat4;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define SIMD4_ENABLED 1
+#define SIMD4_NEON 1
+#include <arm_neon.h>
+typedef float32x4_t SimdFloat4;
+#else
+#define SIMD4_ENABLED 0
+#endif
+
+#if SIMD4_ENABLED
+#ifdef SIMD4_SSE2
+inline SimdFloat4 simdLoad(const float* pPtr) { return _mm_loadu_ps(pPtr); }
+inline void simdStore(float* pPtr, SimdFloat4 pA) { _mm_storeu_ps(pPtr, pA); }
+inline SimdFloat4 simdSplat(float pValue) { return _mm_set1_ps(pValue); }
+inline SimdFloat4 simdAdd(SimdFloat4 pA, SimdFloat4 pB) { return _mm_add_ps(pA, pB); }
+inline SimdFloat4 simdSub(SimdFloat4 pA, SimdFloat4 pB) { return _mm_sub_ps(pA, pB); }
+inline SimdFloat4 simdMul(SimdFloat4 pA, SimdFloat4 pB) { return _mm_mul_ps(pA, pB); }
+inline SimdFloat4 simdMin(SimdFloat4 pA, SimdFloat4 pB) { return _mm_min_ps(pA, pB); }
+inline SimdFloat4 simdMax(SimdFloat4 pA, SimdFloat4 pB) { return _mm_max_ps(pA, pB); }
+inline SimdFloat4 simdAnd(SimdFloat4 pA, SimdFloat4 pB) { return _mm_and_ps(pA, pB); }
+inline SimdFloat4 simdOr(SimdFloat4 pA, SimdFloat4 pB) { return _mm_or_ps(pA, pB); }
+// Rounded toward zero, as float(int32_t(pA))
+inline SimdFloat4 simdTrunc(SimdFloat4 pA) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(pA)); }
+// All bits set in the lanes where pA >= pB
+inline SimdFloat4 simdCmpGe(SimdFloat4 pA, SimdFloat4 pB) { return _mm_cmpge_ps(pA, pB); }
+// Bit ii set if lane ii of a simdCmp*() mask is set
+inline int simdMask(SimdFloat4 pMask) { return _mm_movemask_ps(pMask); }
+#else
+inline SimdFloat4 simdLoad(const float* pPtr) { return vld1q_f32(pPtr); }
+inline void simdStore(float* pPtr, SimdFloat4 pA) { vst1q_f32(pPtr, pA); }
+inline SimdFloat4 simdSplat(float pValue) { return vdupq_n_f32(pValue); }
+inline SimdFloat4 simdAdd(SimdFloat4 pA, SimdFloat4 pB) { return vaddq_f32(pA, pB); }
+inline SimdFloat4 simdSub(SimdFloat4 pA, SimdFloat4 pB) { return vsubq_f32(pA, pB); }
+inline SimdFloat4 simdMul(SimdFloat4 pA, SimdFloat4 pB) { return vmulq_f32(pA, pB); }
+inline SimdFloat4 simdMin(SimdFloat4 pA, SimdFloat4 pB) { return vminq_f32(pA, pB); }
+inline SimdFloat4 simdMax(SimdFloat4 pA, SimdFloat4 pB) { return vmaxq_f32(pA, pB); }
+inline SimdFloat4 simdAnd(SimdFloat4 pA, SimdFloat4 pB) { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(pA), vreinterpretq_u32_f32(pB))); }
+inline SimdFloat4 simdOr(SimdFloat4 pA, SimdFloat4 pB) { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(pA), vreinterpretq_u32_f32(pB))); }
+inline SimdFloat4 simdTrunc(SimdFloat4 pA) { return vcvtq_f32_s32(vcvtq_s32_f32(pA)); }
+inline SimdFloat4 simdCmpGe(SimdFloat4 pA, SimdFloat4 pB) { return vreinterpretq_f32_u32(vcgeq_f32(pA, pB)); }
+inline int simdMask(SimdFloat4 pMask)
+{
+    const uint32x4_t mask = vreinterpretq_u32_f32(pMask);
+    return int((vgetq_lane_u32(mask, 0) & 1) | (vgetq_lane_u32(mask, 1) & 2)
+        | (vgetq_lane_u32(mask, 2) & 4) | (vgetq_lane_u32(mask, 3) & 8));
+}
+#endif
+
+// Magnitude of pA with the sign of pB
+inline SimdFloat4 simdCopySign(SimdFloat4 pA, SimdFloat4 pB)
+{
+    const SimdFloat4 sign = simdSplat(-0.f);
+#ifdef SIMD4_SSE2
+    return simdOr(_mm_andnot_ps(sign, pA), simdAnd(sign, pB));
+#else
+    return vbslq_f32(vreinterpretq_u32_f32(sign), pB, pA);
+#endif
+}
+#endif
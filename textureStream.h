@@ -0,0 +1,286 @@
+#pragma once
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSize>
+#include <QtCore/QStandardPaths>
+#include <bgfx/bgfx.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/******************************************************************************/
+// Full RGBA8 mip chain of an image, level 0 is the full resolution.
+// Built once on the loader pool, then cached on disk by content hash.
+struct MipChain
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t hash = 0;                  // of the source file content
+    std::vector<uint32_t> offsets;      // of each level in data
+    std::vector<uint8_t> data;
+
+    uint32_t numMips() const { return uint32_t(offsets.size()); }
+    uint32_t mipWidth(uint32_t pMip) const { return std::max<uint32_t>(1, width >> pMip); }
+    uint32_t mipHeight(uint32_t pMip) const { return std::max<uint32_t>(1, height >> pMip); }
+    uint32_t mipSize(uint32_t pMip) const { return mipWidth(pMip) * mipHeight(pMip) * 4; }
+    const uint8_t* mipData(uint32_t pMip) const { return data.data() + offsets[pMip]; }
+
+    // Same level count as bgfx for a texture of this size
+    static uint32_t mipCount(uint32_t pWidth, uint32_t pHeight)
+    {
+        uint32_t count = 1;
+        for (uint32_t size = std::max(pWidth, pHeight); size > 1; size >>= 1)
+            ++count;
+        return count;
+    }
+
+    // 2x2 box filter from level 0 in data
+    void generate(const uint8_t* pPixels, uint32_t pWidth, uint32_t pHeight)
+    {
+        width = pWidth;
+        height = pHeight;
+        offsets.resize(mipCount(pWidth, pHeight));
+        uint32_t total = 0;
+        for (uint32_t mip = 0; mip < numMips(); ++mip)
+        {
+            offsets[mip] = total;
+            total += mipSize(mip);
+        }
+        data.resize(total);
+        std::copy(pPixels, pPixels + mipSize(0), data.begin());
+
+        for (uint32_t mip = 1; mip < numMips(); ++mip)
+        {
+            const uint32_t srcWidth = mipWidth(mip - 1);
+            const uint32_t srcHeight = mipHeight(mip - 1);
+            const uint8_t* src = mipData(mip - 1);
+            uint8_t* dst = data.data() + offsets[mip];
+            for (uint32_t yy = 0; yy < mipHeight(mip); ++yy)
+            {
+                const uint32_t y0 = std::min(yy * 2, srcHeight - 1);
+                const uint32_t y1 = std::min(yy * 2 + 1, srcHeight - 1);
+                for (uint32_t xx = 0; xx < mipWidth(mip); ++xx)
+                {
+                    const uint32_t x0 = std::min(xx * 2, srcWidth - 1);
+                    const uint32_t x1 = std::min(xx * 2 + 1, srcWidth - 1);
+                    for (uint32_t cc = 0; cc < 4; ++cc)
+                    {
+                        const uint32_t sum = src[(y0 * srcWidth + x0) * 4 + cc] + src[(y0 * srcWidth + x1) * 4 + cc]
+                            + src[(y1 * srcWidth + x0) * 4 + cc] + src[(y1 * srcWidth + x1) * 4 + cc];
+                        *dst++ = uint8_t((sum + 2) / 4);
+                    }
+                }
+            }
+        }
+    }
+
+    // --- Disk cache, one file per source content hash
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t dataSize;
+    };
+
+    static QString cachePath(uint32_t pHash)
+    {
+        return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + QString("/mips/%1.mips").arg(pHash, 8, 16, QLatin1Char('0'));
+    }
+
+    bool readCache(uint32_t pHash)
+    {
+        QFile file(cachePath(pHash));
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+
+        CacheHeader header;
+        if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header))
+            || std::memcmp(header.magic, "MIPS", 4) != 0 || header.version != 1)
+            return false;
+
+        MipChain chain;
+        chain.width = header.width;
+        chain.height = header.height;
+        chain.hash = pHash;
+        chain.offsets.resize(mipCount(header.width, header.height));
+        uint32_t total = 0;
+        for (uint32_t mip = 0; mip < chain.numMips(); ++mip)
+        {
+            chain.offsets[mip] = total;
+            total += chain.mipSize(mip);
+        }
+        if (total != header.dataSize)
+            return false;
+
+        chain.data.resize(total);
+        if (file.read(reinterpret_cast<char*>(chain.data.data()), total) != qint64(total))
+            return false;
+
+        *this = std::move(chain);
+        return true;
+    }
+
+    void writeCache() const
+    {
+        QDir().mkpath(QFileInfo(cachePath(hash)).absolutePath());
+        QSaveFile file(cachePath(hash));
+        if (!file.open(QIODevice::WriteOnly))
+            return;
+
+        const CacheHeader header = { { 'M', 'I', 'P', 'S' }, 1, width, height, uint32_t(data.size()) };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data.data()), qint64(data.size()));
+        file.commit();
+    }
+};
+
+/******************************************************************************/
+// Texture streamed from a MipChain, only the levels needed for the target size are
+// resident. The bgfx texture is allocated at the size of the finest needed level
+// (base level), its mips are uploaded from the coarsest to the finest with
+// bgfx::updateTexture2D(), a few per frame (see bgfxResourceLoader::processUploads).
+// Until a level is uploaded the shader clamps sampling to the resident ones (lod()).
+// When the target grows, a larger texture is streamed the same way and replaces the
+// displayed one once it has at least the same detail.
+// API thread only.
+class TextureStream
+{
+public:
+    // pChanged is called when the displayed texture or its resident levels change
+    TextureStream(std::shared_ptr<const MipChain> pMips, std::function<void()> pChanged)
+        : m_mips(std::move(pMips)), m_changed(std::move(pChanged))
+    {
+    }
+
+    ~TextureStream()
+    {
+        m_displayed.destroy();
+        m_streaming.destroy();
+    }
+
+    // MipChain::hash, the content streamed
+    uint32_t hash() const { return m_mips->hash; }
+
+    // Displayed size, in pixels. The needed level is the smallest one at least that large.
+    void setTargetSize(const QSize& pSize)
+    {
+        uint32_t level = 0;
+        while (level + 1 < m_mips->numMips()
+            && m_mips->mipWidth(level + 1) >= uint32_t(std::max(pSize.width(), 1))
+            && m_mips->mipHeight(level + 1) >= uint32_t(std::max(pSize.height(), 1)))
+        {
+            ++level;
+        }
+        m_targetLevel = level;
+    }
+
+    // Upload the next level if it fits in pBudgetBytes (the first upload of a call
+    // always does), returns false when there is nothing to upload.
+    bool step(uint32_t& pBudgetBytes, bool pForce)
+    {
+        // Stream a texture for the needed base level, unless it's the displayed one
+        if (!m_displayed.isValid() || m_displayed.baseLevel != m_targetLevel)
+        {
+            if (m_streaming.isValid() && m_streaming.baseLevel != m_targetLevel)
+                m_streaming.destroy();
+            if (!m_streaming.isValid())
+                m_streaming.create(*m_mips, m_targetLevel);
+        }
+        else
+        {
+            m_streaming.destroy(); // target went back to the displayed texture
+        }
+
+        Texture& texture = m_streaming.isValid() ? m_streaming : m_displayed;
+        if (texture.residentLevel == texture.baseLevel)
+            return false; // complete
+
+        const uint32_t mip = texture.residentLevel - 1;
+        const uint32_t size = m_mips->mipSize(mip);
+        if (!pForce && size > pBudgetBytes)
+            return false;
+        pBudgetBytes -= std::min(size, pBudgetBytes);
+
+        // No copy, the chain is kept alive until bgfx is done with the level
+        const bgfx::Memory* mem = bgfx::makeRef(m_mips->mipData(mip), size,
+            [](void*, void* pUserData) { delete static_cast<std::shared_ptr<const MipChain>*>(pUserData); },
+            new std::shared_ptr<const MipChain>(m_mips));
+        bgfx::updateTexture2D(texture.handle, 0, uint8_t(mip - texture.baseLevel), 0, 0,
+            uint16_t(m_mips->mipWidth(mip)), uint16_t(m_mips->mipHeight(mip)), mem);
+        texture.residentLevel = mip;
+
+        if (&texture == &m_displayed)
+        {
+            m_changed();
+        }
+        else if (!m_displayed.isValid() || m_streaming.residentLevel <= std::max(m_displayed.residentLevel, m_targetLevel))
+        {
+            // The streamed texture is as detailed as needed, or as the displayed one: replace it
+            m_displayed.destroy();
+            m_displayed = m_streaming;
+            m_streaming = Texture();
+            m_changed();
+        }
+        return true;
+    }
+
+    bool isComplete() const
+    {
+        return !m_streaming.isValid() && m_displayed.isValid() && m_displayed.baseLevel == m_targetLevel
+            && m_displayed.residentLevel == m_displayed.baseLevel;
+    }
+
+    // Displayed texture, invalid until its coarsest level is uploaded
+    bgfx::TextureHandle handle() const
+    {
+        return m_displayed.residentLevel < m_mips->numMips() ? m_displayed.handle : bgfx::TextureHandle(BGFX_INVALID_HANDLE);
+    }
+
+    // x: finest resident mip of handle(), yz: size of handle() level 0
+    void lod(float* pLod) const
+    {
+        pLod[0] = float(m_displayed.residentLevel - m_displayed.baseLevel);
+        pLod[1] = float(m_mips->mipWidth(m_displayed.baseLevel));
+        pLod[2] = float(m_mips->mipHeight(m_displayed.baseLevel));
+        pLod[3] = 0.f;
+    }
+
+private:
+    struct Texture
+    {
+        bgfx::TextureHandle handle = BGFX_INVALID_HANDLE;
+        uint32_t baseLevel = 0;         // chain level of the texture level 0
+        uint32_t residentLevel = 0;     // finest chain level uploaded, numMips if none
+
+        bool isValid() const { return bgfx::isValid(handle); }
+
+        void create(const MipChain& pMips, uint32_t pBaseLevel)
+        {
+            baseLevel = pBaseLevel;
+            residentLevel = pMips.numMips();
+            handle = bgfx::createTexture2D(uint16_t(pMips.mipWidth(pBaseLevel)), uint16_t(pMips.mipHeight(pBaseLevel)), true, 1,
+                bgfx::TextureFormat::RGBA8, BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP, NULL);
+        }
+
+        void destroy()
+        {
+            if (isValid())
+                bgfx::destroy(handle);
+            *this = Texture();
+        }
+    };
+
+    std::shared_ptr<const MipChain> m_mips;
+    std::function<void()> m_changed;
+    uint32_t m_targetLevel = 0;
+    Texture m_displayed;
+    Texture m_streaming;
+};
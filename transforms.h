@@ -0,0 +1,148 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "simd4.h"
+
+/******************************************************************************/
+// Animated transforms in structure of arrays layout: a translation and a rotation
+// phase per instance, the model matrix is
+//      rotateXY(time + phaseX, time + phaseY), translated by (x, y, z)
+// (same as bx::mtxRotateXY() followed by setting the translation).
+// compute() builds the matrices of many instances in one pass: the sine and cosine
+// are evaluated a block at a time over contiguous floats, 4 at a time with SSE2 or
+// NEON (simd4.h), then the matrices are written straight to their destination (bgfx
+// transform cache or instance data buffer).
+struct AnimatedTransforms
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> phaseX;
+    std::vector<float> phaseY;
+
+    uint32_t size() const { return uint32_t(x.size()); }
+
+    void resize(uint32_t pCount)
+    {
+        x.resize(pCount);
+        y.resize(pCount);
+        z.resize(pCount);
+        phaseX.resize(pCount);
+        phaseY.resize(pCount);
+    }
+
+    // Write the 4x4 matrices of instances pIndices[0, pCount) at pTime to pOut, pStride
+    // bytes apart (64 for tightly packed matrices). pIndices null for instances [0, pCount).
+    void compute(const uint32_t* pIndices, uint32_t pCount, float pTime, uint8_t* pOut, uint32_t pStride) const
+    {
+        float ax[BlockSize], ay[BlockSize];
+        float sx[BlockSize], cx[BlockSize], sy[BlockSize], cy[BlockSize];
+
+        for (uint32_t first = 0; first < pCount; first += BlockSize)
+        {
+            const uint32_t count = std::min(pCount - first, uint32_t(BlockSize));
+            const uint32_t* indices = pIndices ? pIndices + first : nullptr;
+
+            if (indices)
+            {
+                for (uint32_t ii = 0; ii < count; ++ii)
+                {
+                    ax[ii] = pTime + phaseX[indices[ii]];
+                    ay[ii] = pTime + phaseY[indices[ii]];
+                }
+            }
+            else
+            {
+                for (uint32_t ii = 0; ii < count; ++ii)
+                {
+                    ax[ii] = pTime + phaseX[first + ii];
+                    ay[ii] = pTime + phaseY[first + ii];
+                }
+            }
+
+            sinCos(ax, sx, cx, count);
+            sinCos(ay, sy, cy, count);
+
+            uint8_t* out = pOut + uint64_t(first) * pStride;
+            for (uint32_t ii = 0; ii < count; ++ii)
+            {
+                const uint32_t instance = indices ? indices[ii] : first + ii;
+                float* mtx = reinterpret_cast<float*>(out);
+                mtx[0] = cy[ii];            mtx[1] = 0.f;       mtx[2] = sy[ii];            mtx[3] = 0.f;
+                mtx[4] = sx[ii] * sy[ii];   mtx[5] = cx[ii];    mtx[6] = -sx[ii] * cy[ii];  mtx[7] = 0.f;
+                mtx[8] = -cx[ii] * sy[ii];  mtx[9] = sx[ii];    mtx[10] = cx[ii] * cy[ii];  mtx[11] = 0.f;
+                mtx[12] = x[instance];      mtx[13] = y[instance]; mtx[14] = z[instance];   mtx[15] = 1.f;
+                out += pStride;
+            }
+        }
+    }
+
+    // Sine and cosine of pCount angles, branchless. Max error ~3e-7 for angles up to
+    // a few thousand radians (time in seconds plus phase).
+    static void sinCos(const float* pAngle, float* pSin, float* pCos, uint32_t pCount)
+    {
+        const float pi = 3.14159265f;
+        const float halfPi = 1.57079633f;
+        const float invTwoPi = 0.159154943f;
+        const float twoPiHi = 6.28125f;             // exact in float, k * twoPiHi too
+        const float twoPiLo = 1.93530717958e-3f;    // 2 pi - twoPiHi
+
+        uint32_t ii = 0;
+#if SIMD4_ENABLED
+        // Same steps as the scalar loop below
+        for (; ii + 4 <= pCount; ii += 4)
+        {
+            const SimdFloat4 angle = simdLoad(pAngle + ii);
+            const SimdFloat4 kk = simdTrunc(simdAdd(simdMul(angle, simdSplat(invTwoPi)), simdCopySign(simdSplat(0.5f), angle)));
+            const SimdFloat4 rr = simdSub(simdSub(angle, simdMul(kk, simdSplat(twoPiHi))), simdMul(kk, simdSplat(twoPiLo)));
+
+            const SimdFloat4 ss = simdMax(simdMin(rr, simdSub(simdSplat(pi), rr)), simdSub(simdSplat(-pi), rr));
+            const SimdFloat4 cc = simdMin(simdSub(simdSplat(halfPi), rr), simdAdd(simdSplat(halfPi), rr));
+
+            simdStore(pSin + ii, sinPoly(ss));
+            simdStore(pCos + ii, sinPoly(cc));
+        }
+#endif
+        for (; ii < pCount; ++ii)
+        {
+            // Reduce to [-pi, pi]
+            const float angle = pAngle[ii];
+            const float kk = float(int32_t(angle * invTwoPi + std::copysign(0.5f, angle)));
+            const float rr = (angle - kk * twoPiHi) - kk * twoPiLo;
+
+            // sin(r) and cos(r) = sin(pi/2 - r), reflected to [-pi/2, pi/2]
+            const float ss = std::max(std::min(rr, pi - rr), -pi - rr);
+            const float cc = std::min(halfPi - rr, halfPi + rr);
+
+            pSin[ii] = sinPoly(ss);
+            pCos[ii] = sinPoly(cc);
+        }
+    }
+
+private:
+    static const uint32_t BlockSize = 64;
+
+    // Taylor series to x^11, for x in [-pi/2, pi/2]
+    static float sinPoly(float pX)
+    {
+        const float x2 = pX * pX;
+        return pX * (1.f + x2 * (-1.f / 6.f + x2 * (1.f / 120.f + x2 * (-1.f / 5040.f
+            + x2 * (1.f / 362880.f + x2 * (-1.f / 39916800.f))))));
+    }
+
+#if SIMD4_ENABLED
+    static SimdFloat4 sinPoly(SimdFloat4 pX)
+    {
+        const SimdFloat4 x2 = simdMul(pX, pX);
+        SimdFloat4 poly = simdAdd(simdSplat(1.f / 362880.f), simdMul(x2, simdSplat(-1.f / 39916800.f)));
+        poly = simdAdd(simdSplat(-1.f / 5040.f), simdMul(x2, poly));
+        poly = simdAdd(simdSplat(1.f / 120.f), simdMul(x2, poly));
+        poly = simdAdd(simdSplat(-1.f / 6.f), simdMul(x2, poly));
+        poly = simdAdd(simdSplat(1.f), simdMul(x2, poly));
+        return simdMul(pX, poly);
+    }
+#endif
+};